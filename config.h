@@ -4,25 +4,52 @@
 #define WIDTH 1280
 #define HEIGHT 960
 #define SPACING 3
+/* Agents start on sites, one every SPACING pixels in each direction */
+#define COLUMNS ((WIDTH + SPACING - 1) / SPACING)
+#define ROWS ((HEIGHT + SPACING - 1) / SPACING)
+#define SITES (COLUMNS * ROWS)
+/* Defaults for the workgroup sizes, variants are built with these overridden */
+#ifndef THREADS_X
 #define THREADS_X 32
+#endif
+#ifndef THREADS_Y
 #define THREADS_Y 32
+#endif
+#ifndef AGENT_THREADS
+#define AGENT_THREADS 256
+#endif
+#define TUNE_WARMUP 16
+#define TUNE_ITERATIONS 64
 #define SENSORS 3
 #define AGENT_SPEED 0.5f
 #define AGENT_STEER_SPEED 2.5f
 #define SENSE_SIZE 5
 #define SENSE_DISTANCE 5.0f
 #define SENSE_ANGLE 0.7f
+#define SAT_THREADS 256
+#define SAT_SCALE 1024.0f
+#define SORT_INTERVAL 120
+#define SORT_SAMPLES 8
+#define SORT_THREADS 1024
+#define SORT_SHIFT 3
+#define SORT_BINS 65536
+#define TIMESTEP (1.0f / 60.0f)
+#define MAX_STEPS 4
+#define MAX_FRAMES_IN_FLIGHT 3
+#define FAST_FORWARD_BATCH 64
+#define SPAWN_EDGE_WEIGHT 4
+#define MAX_AGENTS (1 << 24)
+#define UPLOAD_CHUNKS 4
+#define UPLOAD_CHUNK_SIZE 262144
+#define POOL_SIZE 32
 #define DIFFUSE_SPEED 0.5f
 #define EVAPORATE_SPEED 0.05f
 #define TRAIL_WEIGHT 1.0f
 
-#define COLOR_RED 0
-#define COLOR_GREEN 1
-#define COLOR_BLUE 2
-#define COLOR_WHITE 3
-#define COLOR_MAGENTA 4
-#define COLOR_CYAN 5
-#define COLOR_YELLOW 6
+/* Most species a clustered palette can have, the deposit pass handles up to 16 */
 #define COLOR_COUNT 7
+#define TRAIL_LAYERS ((COLOR_COUNT + 3) / 4)
+#define SAT_LAYERS (COLOR_COUNT + 1)
+#define CACHE_BITS 3
 
 #endif
\ No newline at end of file
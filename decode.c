@@ -0,0 +1,1228 @@
+#include <SDL3/SDL.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decode.h"
+#include "util.h"
+
+/* Streaming decoders for non-interlaced PNG and baseline JPEG, one row at a time. */
+/* decoder_open returns NULL for anything else, which is then loaded whole. */
+
+#define INPUT_SIZE 65536
+#define FAST_BITS 9
+#define WINDOW_SIZE 32768
+#define MAX_DIMENSION (1 << 24)
+
+typedef struct
+{
+    /* Short codes are looked up directly, the rest are decoded bit by bit */
+    uint16_t fast[1 << FAST_BITS];
+    uint16_t counts[17];
+    uint16_t symbols[288];
+}
+huffman_t;
+
+typedef struct
+{
+    uint32_t bits;
+    int count;
+    uint32_t chunk;
+    bool end;
+    int state;
+    bool last;
+    uint32_t stored;
+    uint32_t copy_length;
+    uint32_t copy_distance;
+    uint32_t position;
+    uint8_t window[WINDOW_SIZE];
+    huffman_t lengths;
+    huffman_t distances;
+    int depth;
+    int type;
+    int channels;
+    int stride;
+    int bpp;
+    uint8_t palette[256 * 3];
+    uint8_t* current;
+    uint8_t* previous;
+}
+png_t;
+
+typedef struct
+{
+    int id;
+    int h;
+    int v;
+    int quantization;
+    int dc;
+    int ac;
+    int prediction;
+    int width;
+    uint8_t* plane;
+}
+component_t;
+
+typedef struct
+{
+    uint32_t bits;
+    int count;
+    bool marker;
+    uint16_t quantizations[4][64];
+    huffman_t huffmans[8];
+    /* Canonical code ranges per length for codes longer than FAST_BITS */
+    int32_t max_codes[8][18];
+    int32_t offsets[8][17];
+    component_t components[3];
+    int component_count;
+    int h;
+    int v;
+    int mcu_columns;
+    int restart_interval;
+    int restart_count;
+    int restart_marker;
+    int row;
+    float idct[8][8];
+}
+jpeg_t;
+
+struct decoder
+{
+    SDL_IOStream* io;
+    uint8_t input[INPUT_SIZE];
+    size_t position;
+    size_t size;
+    bool error;
+    bool is_png;
+    int width;
+    int height;
+    int y;
+    png_t png;
+    jpeg_t jpeg;
+};
+
+static int read_byte(
+    decoder_t* decoder)
+{
+    if (decoder->position == decoder->size)
+    {
+        decoder->position = 0;
+        decoder->size = SDL_ReadIO(decoder->io, decoder->input, INPUT_SIZE);
+        if (!decoder->size)
+        {
+            decoder->error = true;
+            return -1;
+        }
+    }
+    return decoder->input[decoder->position++];
+}
+
+static uint32_t read_u16(
+    decoder_t* decoder)
+{
+    const uint32_t a = read_byte(decoder);
+    const uint32_t b = read_byte(decoder);
+    return a << 8 | b;
+}
+
+static uint32_t read_u32(
+    decoder_t* decoder)
+{
+    const uint32_t a = read_u16(decoder);
+    const uint32_t b = read_u16(decoder);
+    return a << 16 | b;
+}
+
+static void skip(
+    decoder_t* decoder,
+    uint32_t count)
+{
+    for (uint32_t i = 0; i < count && !decoder->error; i++)
+    {
+        read_byte(decoder);
+    }
+}
+
+static uint32_t reverse(
+    uint32_t code,
+    int length)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < length; i++)
+    {
+        result = (result << 1) | ((code >> i) & 1);
+    }
+    return result;
+}
+
+/* Deflate codes are read starting from the least significant bit */
+static bool build_inflate_huffman(
+    huffman_t* huffman,
+    const uint8_t* lengths,
+    int count)
+{
+    memset(huffman, 0, sizeof(*huffman));
+    for (int i = 0; i < count; i++)
+    {
+        huffman->counts[lengths[i]]++;
+    }
+    huffman->counts[0] = 0;
+    uint16_t offsets[17] = {0};
+    for (int i = 1; i < 16; i++)
+    {
+        offsets[i + 1] = offsets[i] + huffman->counts[i];
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (lengths[i])
+        {
+            huffman->symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+    uint32_t code = 0;
+    int index = 0;
+    for (int length = 1; length < 16; length++)
+    {
+        for (int i = 0; i < huffman->counts[length]; i++, code++, index++)
+        {
+            if (length > FAST_BITS)
+            {
+                continue;
+            }
+            const uint16_t entry = huffman->symbols[index] << 4 | length;
+            for (uint32_t j = reverse(code, length); j < (1 << FAST_BITS); j += 1 << length)
+            {
+                huffman->fast[j] = entry;
+            }
+        }
+        code <<= 1;
+        if (code > (1u << (length + 1)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int png_byte(
+    decoder_t* decoder)
+{
+    png_t* png = &decoder->png;
+    /* Compressed data continues across consecutive IDAT chunks */
+    while (!png->chunk)
+    {
+        skip(decoder, 4);
+        png->chunk = read_u32(decoder);
+        const uint32_t type = read_u32(decoder);
+        if (decoder->error || type != 0x49444154)
+        {
+            png->end = true;
+            return -1;
+        }
+    }
+    png->chunk--;
+    return read_byte(decoder);
+}
+
+static void fill_inflate(
+    decoder_t* decoder)
+{
+    png_t* png = &decoder->png;
+    while (png->count <= 24 && !png->end)
+    {
+        const int byte = png_byte(decoder);
+        if (byte < 0)
+        {
+            break;
+        }
+        png->bits |= (uint32_t) byte << png->count;
+        png->count += 8;
+    }
+}
+
+static uint32_t inflate_bits(
+    decoder_t* decoder,
+    int count)
+{
+    png_t* png = &decoder->png;
+    if (!count)
+    {
+        return 0;
+    }
+    fill_inflate(decoder);
+    if (png->count < count)
+    {
+        decoder->error = true;
+        return 0;
+    }
+    const uint32_t value = png->bits & ((1u << count) - 1);
+    png->bits >>= count;
+    png->count -= count;
+    return value;
+}
+
+static int inflate_decode(
+    decoder_t* decoder,
+    const huffman_t* huffman)
+{
+    png_t* png = &decoder->png;
+    fill_inflate(decoder);
+    const uint16_t entry = huffman->fast[png->bits & ((1 << FAST_BITS) - 1)];
+    if (entry && (entry & 15) <= png->count)
+    {
+        png->bits >>= entry & 15;
+        png->count -= entry & 15;
+        return entry >> 4;
+    }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length < 16; length++)
+    {
+        code |= inflate_bits(decoder, 1);
+        const int count = huffman->counts[length];
+        if (code - count < first)
+        {
+            return huffman->symbols[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    decoder->error = true;
+    return 0;
+}
+
+static bool inflate_tables(
+    decoder_t* decoder,
+    int type)
+{
+    png_t* png = &decoder->png;
+    uint8_t lengths[320] = {0};
+    if (type == 1)
+    {
+        for (int i = 0; i < 288; i++)
+        {
+            lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        }
+        for (int i = 0; i < 30; i++)
+        {
+            lengths[288 + i] = 5;
+        }
+        return build_inflate_huffman(&png->lengths, lengths, 288) &&
+            build_inflate_huffman(&png->distances, lengths + 288, 30);
+    }
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    const int literals = inflate_bits(decoder, 5) + 257;
+    const int distances = inflate_bits(decoder, 5) + 1;
+    const int codes = inflate_bits(decoder, 4) + 4;
+    uint8_t code_lengths[19] = {0};
+    for (int i = 0; i < codes; i++)
+    {
+        code_lengths[order[i]] = inflate_bits(decoder, 3);
+    }
+    huffman_t huffman;
+    if (!build_inflate_huffman(&huffman, code_lengths, 19))
+    {
+        return false;
+    }
+    int index = 0;
+    while (index < literals + distances && !decoder->error)
+    {
+        const int symbol = inflate_decode(decoder, &huffman);
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+        int length = 0;
+        int repeat;
+        if (symbol == 16)
+        {
+            if (!index)
+            {
+                return false;
+            }
+            length = lengths[index - 1];
+            repeat = 3 + inflate_bits(decoder, 2);
+        }
+        else if (symbol == 17)
+        {
+            repeat = 3 + inflate_bits(decoder, 3);
+        }
+        else
+        {
+            repeat = 11 + inflate_bits(decoder, 7);
+        }
+        if (index + repeat > literals + distances)
+        {
+            return false;
+        }
+        while (repeat--)
+        {
+            lengths[index++] = length;
+        }
+    }
+    return !decoder->error &&
+        build_inflate_huffman(&png->lengths, lengths, literals) &&
+        build_inflate_huffman(&png->distances, lengths + literals, distances);
+}
+
+enum
+{
+    INFLATE_HEADER,
+    INFLATE_STORED,
+    INFLATE_HUFFMAN,
+};
+
+static bool inflate(
+    decoder_t* decoder,
+    uint8_t* data,
+    int size)
+{
+    static const uint16_t length_bases[29] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+    };
+    static const uint8_t length_extras[29] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+    };
+    static const uint16_t distance_bases[30] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+    };
+    static const uint8_t distance_extras[30] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+    };
+    png_t* png = &decoder->png;
+    int index = 0;
+    while (index < size && !decoder->error)
+    {
+        int byte;
+        if (png->copy_length)
+        {
+            byte = png->window[(png->position - png->copy_distance) & (WINDOW_SIZE - 1)];
+            png->copy_length--;
+        }
+        else if (png->state == INFLATE_STORED)
+        {
+            byte = inflate_bits(decoder, 8);
+            if (!--png->stored)
+            {
+                png->state = INFLATE_HEADER;
+            }
+        }
+        else if (png->state == INFLATE_HUFFMAN)
+        {
+            const int symbol = inflate_decode(decoder, &png->lengths);
+            if (symbol < 256)
+            {
+                byte = symbol;
+            }
+            else if (symbol == 256)
+            {
+                png->state = INFLATE_HEADER;
+                continue;
+            }
+            else
+            {
+                const int length = symbol - 257;
+                if (length >= 29)
+                {
+                    return false;
+                }
+                png->copy_length = length_bases[length] + inflate_bits(decoder, length_extras[length]);
+                const int distance = inflate_decode(decoder, &png->distances);
+                if (distance >= 30)
+                {
+                    return false;
+                }
+                png->copy_distance = distance_bases[distance] + inflate_bits(decoder, distance_extras[distance]);
+                continue;
+            }
+        }
+        else
+        {
+            if (png->last)
+            {
+                return false;
+            }
+            png->last = inflate_bits(decoder, 1);
+            const int type = inflate_bits(decoder, 2);
+            if (type == 0)
+            {
+                /* Stored blocks start on a byte boundary */
+                inflate_bits(decoder, png->count & 7);
+                png->stored = inflate_bits(decoder, 16);
+                if ((png->stored ^ 0xFFFF) != inflate_bits(decoder, 16))
+                {
+                    return false;
+                }
+                if (png->stored)
+                {
+                    png->state = INFLATE_STORED;
+                }
+            }
+            else if (type == 3 || !inflate_tables(decoder, type))
+            {
+                return false;
+            }
+            else
+            {
+                png->state = INFLATE_HUFFMAN;
+            }
+            continue;
+        }
+        png->window[png->position++ & (WINDOW_SIZE - 1)] = byte;
+        data[index++] = byte;
+    }
+    return !decoder->error;
+}
+
+static int paeth(
+    int a,
+    int b,
+    int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+    {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static bool open_png(
+    decoder_t* decoder)
+{
+    png_t* png = &decoder->png;
+    while (!decoder->error)
+    {
+        const uint32_t length = read_u32(decoder);
+        const uint32_t type = read_u32(decoder);
+        if (type == 0x49484452)
+        {
+            /* IHDR */
+            decoder->width = read_u32(decoder);
+            decoder->height = read_u32(decoder);
+            png->depth = read_byte(decoder);
+            png->type = read_byte(decoder);
+            const int compression = read_byte(decoder);
+            const int filter = read_byte(decoder);
+            const int interlace = read_byte(decoder);
+            skip(decoder, length - 13 + 4);
+            if (compression || filter || interlace)
+            {
+                return false;
+            }
+            switch (png->type)
+            {
+            case 0:
+            case 3:
+                png->channels = 1;
+                break;
+            case 2:
+                png->channels = 3;
+                break;
+            case 4:
+                png->channels = 2;
+                break;
+            case 6:
+                png->channels = 4;
+                break;
+            default:
+                return false;
+            }
+            /* Grayscale allows 1, 2, 4, 8 and 16 bits, palettes up to 8 and the rest 8 or 16 */
+            const int depth = png->depth;
+            const bool packed = depth == 1 || depth == 2 || depth == 4;
+            if (!(depth == 8 || (depth == 16 && png->type != 3) || (packed && png->channels == 1)))
+            {
+                return false;
+            }
+        }
+        else if (type == 0x504C5445)
+        {
+            /* PLTE */
+            if (length > sizeof(png->palette))
+            {
+                return false;
+            }
+            for (uint32_t i = 0; i < length; i++)
+            {
+                png->palette[i] = read_byte(decoder);
+            }
+            skip(decoder, 4);
+        }
+        else if (type == 0x49444154)
+        {
+            /* IDAT, everything after this is read as a stream */
+            png->chunk = length;
+            break;
+        }
+        else
+        {
+            skip(decoder, length + 4);
+        }
+    }
+    /* Bounded so the row stride can't overflow */
+    if (decoder->error || decoder->width <= 0 || decoder->height <= 0 ||
+        decoder->width > MAX_DIMENSION || decoder->height > MAX_DIMENSION)
+    {
+        return false;
+    }
+    png->stride = (decoder->width * png->channels * png->depth + 7) / 8;
+    png->bpp = SDL_max(1, png->channels * png->depth / 8);
+    png->current = calloc(png->stride, 1);
+    png->previous = calloc(png->stride, 1);
+    if (!png->current || !png->previous)
+    {
+        return false;
+    }
+    /* The zlib header */
+    const int method = inflate_bits(decoder, 8);
+    const int flags = inflate_bits(decoder, 8);
+    return (method & 15) == 8 && !(flags & 32) && !((method << 8 | flags) % 31);
+}
+
+static bool read_png(
+    decoder_t* decoder,
+    uint8_t* row)
+{
+    png_t* png = &decoder->png;
+    uint8_t* swap = png->previous;
+    png->previous = png->current;
+    png->current = swap;
+    uint8_t filter;
+    if (!inflate(decoder, &filter, 1) || !inflate(decoder, png->current, png->stride))
+    {
+        return false;
+    }
+    uint8_t* x = png->current;
+    const uint8_t* b = png->previous;
+    for (int i = 0; i < png->stride; i++)
+    {
+        const int a = i >= png->bpp ? x[i - png->bpp] : 0;
+        const int c = i >= png->bpp ? b[i - png->bpp] : 0;
+        switch (filter)
+        {
+        case 0:
+            break;
+        case 1:
+            x[i] += a;
+            break;
+        case 2:
+            x[i] += b[i];
+            break;
+        case 3:
+            x[i] += (a + b[i]) / 2;
+            break;
+        case 4:
+            x[i] += paeth(a, b[i], c);
+            break;
+        default:
+            return false;
+        }
+    }
+    const int step = png->depth / 8;
+    for (int i = 0; i < decoder->width; i++)
+    {
+        uint8_t* pixel = &row[i * 3];
+        if (png->depth < 8)
+        {
+            /* Packed samples, most significant first */
+            const int bit = i * png->depth;
+            const int value = (x[bit / 8] >> (8 - png->depth - bit % 8)) & ((1 << png->depth) - 1);
+            if (png->type == 3)
+            {
+                memcpy(pixel, &png->palette[value * 3], 3);
+            }
+            else
+            {
+                memset(pixel, value * 255 / ((1 << png->depth) - 1), 3);
+            }
+            continue;
+        }
+        /* 16 bit samples are big endian so the first byte is the high one */
+        const uint8_t* sample = &x[i * png->channels * step];
+        switch (png->type)
+        {
+        case 0:
+        case 4:
+            memset(pixel, sample[0], 3);
+            break;
+        case 2:
+        case 6:
+            pixel[0] = sample[0];
+            pixel[1] = sample[step];
+            pixel[2] = sample[step * 2];
+            break;
+        case 3:
+            memcpy(pixel, &png->palette[sample[0] * 3], 3);
+            break;
+        }
+    }
+    return true;
+}
+
+static void fill_jpeg(
+    decoder_t* decoder)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    while (jpeg->count <= 24)
+    {
+        int byte = 0;
+        if (!jpeg->marker)
+        {
+            byte = read_byte(decoder);
+            if (byte == 0xFF)
+            {
+                int next = read_byte(decoder);
+                while (next == 0xFF)
+                {
+                    next = read_byte(decoder);
+                }
+                if (next)
+                {
+                    /* A marker ends the entropy coded data, pad with zeroes */
+                    jpeg->marker = true;
+                    jpeg->restart_marker = next;
+                    byte = 0;
+                }
+            }
+            if (byte < 0)
+            {
+                byte = 0;
+            }
+        }
+        jpeg->bits |= (uint32_t) byte << (24 - jpeg->count);
+        jpeg->count += 8;
+    }
+}
+
+static int jpeg_bits(
+    decoder_t* decoder,
+    int count)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    if (!count)
+    {
+        return 0;
+    }
+    fill_jpeg(decoder);
+    const int value = jpeg->bits >> (32 - count);
+    jpeg->bits <<= count;
+    jpeg->count -= count;
+    return value;
+}
+
+static int extend(
+    int value,
+    int count)
+{
+    return value < (1 << (count - 1)) ? value - (1 << count) + 1 : value;
+}
+
+/* JPEG codes are read starting from the most significant bit */
+static bool build_jpeg_huffman(
+    jpeg_t* jpeg,
+    int index)
+{
+    huffman_t* huffman = &jpeg->huffmans[index];
+    int32_t* max_codes = jpeg->max_codes[index];
+    int32_t* offsets = jpeg->offsets[index];
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    int32_t code = 0;
+    int symbol = 0;
+    for (int length = 1; length <= 16; length++)
+    {
+        offsets[length] = symbol - code;
+        for (int i = 0; i < huffman->counts[length]; i++, code++, symbol++)
+        {
+            /* Over-subscribed lengths would run past the codes of that length */
+            if (code >= (1 << length))
+            {
+                return false;
+            }
+            if (length > FAST_BITS)
+            {
+                continue;
+            }
+            const int shift = FAST_BITS - length;
+            for (int j = 0; j < (1 << shift); j++)
+            {
+                huffman->fast[code << shift | j] = length << 8 | huffman->symbols[symbol];
+            }
+        }
+        max_codes[length] = huffman->counts[length] ? code - 1 : -1;
+        code <<= 1;
+    }
+    max_codes[17] = INT32_MAX;
+    return true;
+}
+
+static int jpeg_decode(
+    decoder_t* decoder,
+    int index)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    const huffman_t* huffman = &jpeg->huffmans[index];
+    fill_jpeg(decoder);
+    const uint16_t entry = huffman->fast[jpeg->bits >> (32 - FAST_BITS)];
+    if (entry)
+    {
+        jpeg->bits <<= entry >> 8;
+        jpeg->count -= entry >> 8;
+        return entry & 0xFF;
+    }
+    for (int length = FAST_BITS + 1; length <= 16; length++)
+    {
+        const int32_t code = jpeg->bits >> (32 - length);
+        if (code <= jpeg->max_codes[index][length])
+        {
+            const int32_t symbol = jpeg->offsets[index][length] + code;
+            if (symbol < 0 || symbol >= (int32_t) SDL_arraysize(huffman->symbols))
+            {
+                break;
+            }
+            jpeg->bits <<= length;
+            jpeg->count -= length;
+            return huffman->symbols[symbol];
+        }
+    }
+    decoder->error = true;
+    return 0;
+}
+
+static bool open_jpeg(
+    decoder_t* decoder)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    bool frame = false;
+    while (!decoder->error)
+    {
+        if (read_byte(decoder) != 0xFF)
+        {
+            return false;
+        }
+        int marker = read_byte(decoder);
+        while (marker == 0xFF)
+        {
+            marker = read_byte(decoder);
+        }
+        const int length = read_u16(decoder) - 2;
+        if (marker == 0xDB)
+        {
+            /* DQT */
+            int left = length;
+            while (left > 0 && !decoder->error)
+            {
+                const int info = read_byte(decoder);
+                const int precision = info >> 4;
+                if ((info & 15) > 3)
+                {
+                    return false;
+                }
+                for (int i = 0; i < 64; i++)
+                {
+                    jpeg->quantizations[info & 15][i] = precision ? read_u16(decoder) : read_byte(decoder);
+                }
+                left -= 1 + 64 * (precision + 1);
+            }
+        }
+        else if (marker == 0xC4)
+        {
+            /* DHT, DC tables go in 0-3 and AC tables in 4-7 */
+            int left = length;
+            while (left > 0 && !decoder->error)
+            {
+                const int info = read_byte(decoder);
+                if ((info & 15) > 3 || info >> 4 > 1)
+                {
+                    return false;
+                }
+                const int index = (info >> 4) * 4 + (info & 15);
+                huffman_t* huffman = &jpeg->huffmans[index];
+                int total = 0;
+                huffman->counts[0] = 0;
+                for (int i = 1; i <= 16; i++)
+                {
+                    huffman->counts[i] = read_byte(decoder);
+                    total += huffman->counts[i];
+                }
+                if (total > 256)
+                {
+                    return false;
+                }
+                for (int i = 0; i < total; i++)
+                {
+                    huffman->symbols[i] = read_byte(decoder);
+                }
+                if (!build_jpeg_huffman(jpeg, index))
+                {
+                    return false;
+                }
+                left -= 17 + total;
+            }
+        }
+        else if (marker == 0xC0 || marker == 0xC1)
+        {
+            /* SOF0 and SOF1, sequential Huffman */
+            const int precision = read_byte(decoder);
+            decoder->height = read_u16(decoder);
+            decoder->width = read_u16(decoder);
+            jpeg->component_count = read_byte(decoder);
+            if (precision != 8 || (jpeg->component_count != 1 && jpeg->component_count != 3))
+            {
+                return false;
+            }
+            for (int i = 0; i < jpeg->component_count; i++)
+            {
+                component_t* component = &jpeg->components[i];
+                component->id = read_byte(decoder);
+                const int sampling = read_byte(decoder);
+                component->h = sampling >> 4;
+                component->v = sampling & 15;
+                component->quantization = read_byte(decoder);
+                if (component->h < 1 || component->h > 4 || component->v < 1 ||
+                    component->v > 4 || component->quantization > 3)
+                {
+                    return false;
+                }
+            }
+            frame = true;
+        }
+        else if ((marker & 0xF0) == 0xC0 && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            /* Progressive, lossless and arithmetic coding aren't streamed */
+            return false;
+        }
+        else if (marker == 0xDD)
+        {
+            jpeg->restart_interval = read_u16(decoder);
+        }
+        else if (marker == 0xDA)
+        {
+            /* SOS, only a single scan with every component is supported */
+            const int count = read_byte(decoder);
+            if (!frame || count != jpeg->component_count)
+            {
+                return false;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                const int id = read_byte(decoder);
+                const int tables = read_byte(decoder);
+                component_t* component = &jpeg->components[i];
+                if (component->id != id || tables >> 4 > 3 || (tables & 15) > 3)
+                {
+                    return false;
+                }
+                component->dc = tables >> 4;
+                component->ac = 4 + (tables & 15);
+            }
+            skip(decoder, 3);
+            break;
+        }
+        else if (marker == 0xD9)
+        {
+            return false;
+        }
+        else
+        {
+            skip(decoder, length);
+        }
+    }
+    if (decoder->error || decoder->width <= 0 || decoder->height <= 0)
+    {
+        return false;
+    }
+    /* A single component scan isn't interleaved so its MCU is always one block */
+    if (jpeg->component_count == 1)
+    {
+        jpeg->components[0].h = 1;
+        jpeg->components[0].v = 1;
+    }
+    for (int i = 0; i < jpeg->component_count; i++)
+    {
+        jpeg->h = SDL_max(jpeg->h, jpeg->components[i].h);
+        jpeg->v = SDL_max(jpeg->v, jpeg->components[i].v);
+    }
+    jpeg->mcu_columns = (decoder->width + jpeg->h * 8 - 1) / (jpeg->h * 8);
+    for (int i = 0; i < jpeg->component_count; i++)
+    {
+        component_t* component = &jpeg->components[i];
+        component->width = jpeg->mcu_columns * component->h * 8;
+        component->plane = malloc(component->width * component->v * 8);
+        if (!component->plane)
+        {
+            return false;
+        }
+    }
+    for (int x = 0; x < 8; x++)
+    for (int u = 0; u < 8; u++)
+    {
+        const float scale = u ? 0.5f : 0.5f / sqrtf(2.0f);
+        jpeg->idct[x][u] = scale * cosf((2 * x + 1) * u * SDL_PI_F / 16.0f);
+    }
+    jpeg->restart_count = jpeg->restart_interval;
+    jpeg->row = jpeg->v * 8;
+    return true;
+}
+
+static void decode_block(
+    decoder_t* decoder,
+    component_t* component,
+    uint8_t* output)
+{
+    static const uint8_t zigzag[64] =
+    {
+        0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+        12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    };
+    jpeg_t* jpeg = &decoder->jpeg;
+    const uint16_t* quantization = jpeg->quantizations[component->quantization];
+    float coefficients[64] = {0};
+    const int size = jpeg_decode(decoder, component->dc);
+    if (size > 16)
+    {
+        decoder->error = true;
+        return;
+    }
+    if (size)
+    {
+        component->prediction += extend(jpeg_bits(decoder, size), size);
+    }
+    coefficients[0] = component->prediction * quantization[0];
+    for (int k = 1; k < 64 && !decoder->error;)
+    {
+        const int symbol = jpeg_decode(decoder, component->ac);
+        const int run = symbol >> 4;
+        const int bits = symbol & 15;
+        if (!bits)
+        {
+            if (run != 15)
+            {
+                break;
+            }
+            k += 16;
+            continue;
+        }
+        k += run;
+        if (k > 63)
+        {
+            decoder->error = true;
+            return;
+        }
+        coefficients[zigzag[k]] = extend(jpeg_bits(decoder, bits), bits) * quantization[k];
+        k++;
+    }
+    float rows[64];
+    for (int y = 0; y < 8; y++)
+    for (int x = 0; x < 8; x++)
+    {
+        float sum = 0.0f;
+        for (int u = 0; u < 8; u++)
+        {
+            sum += jpeg->idct[x][u] * coefficients[y * 8 + u];
+        }
+        rows[y * 8 + x] = sum;
+    }
+    for (int y = 0; y < 8; y++)
+    for (int x = 0; x < 8; x++)
+    {
+        float sum = 128.5f;
+        for (int v = 0; v < 8; v++)
+        {
+            sum += jpeg->idct[y][v] * rows[v * 8 + x];
+        }
+        output[y * component->width + x] = SDL_clamp(sum, 0.0f, 255.0f);
+    }
+}
+
+static bool decode_mcu_row(
+    decoder_t* decoder)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    for (int i = 0; i < jpeg->mcu_columns && !decoder->error; i++)
+    {
+        if (jpeg->restart_interval && !jpeg->restart_count--)
+        {
+            /* Drop the rest of the byte and find the RSTn marker */
+            jpeg->bits = 0;
+            jpeg->count = 0;
+            while (!jpeg->marker && !decoder->error)
+            {
+                if (read_byte(decoder) == 0xFF)
+                {
+                    int marker = read_byte(decoder);
+                    while (marker == 0xFF)
+                    {
+                        marker = read_byte(decoder);
+                    }
+                    jpeg->marker = marker != 0;
+                    jpeg->restart_marker = marker;
+                }
+            }
+            if (jpeg->restart_marker < 0xD0 || jpeg->restart_marker > 0xD7)
+            {
+                return false;
+            }
+            jpeg->marker = false;
+            jpeg->restart_count = jpeg->restart_interval - 1;
+            for (int j = 0; j < jpeg->component_count; j++)
+            {
+                jpeg->components[j].prediction = 0;
+            }
+        }
+        for (int j = 0; j < jpeg->component_count; j++)
+        {
+            component_t* component = &jpeg->components[j];
+            for (int y = 0; y < component->v; y++)
+            for (int x = 0; x < component->h; x++)
+            {
+                const int column = (i * component->h + x) * 8;
+                decode_block(decoder, component, &component->plane[y * 8 * component->width + column]);
+            }
+        }
+    }
+    return !decoder->error;
+}
+
+static bool read_jpeg(
+    decoder_t* decoder,
+    uint8_t* row)
+{
+    jpeg_t* jpeg = &decoder->jpeg;
+    if (jpeg->row == jpeg->v * 8)
+    {
+        if (!decode_mcu_row(decoder))
+        {
+            return false;
+        }
+        jpeg->row = 0;
+    }
+    /* Subsampled components are upsampled by repeating them */
+    const component_t* components = jpeg->components;
+    const uint8_t* y = &components[0].plane[jpeg->row * components[0].v / jpeg->v * components[0].width];
+    if (jpeg->component_count == 1)
+    {
+        for (int i = 0; i < decoder->width; i++)
+        {
+            memset(&row[i * 3], y[i], 3);
+        }
+        jpeg->row++;
+        return true;
+    }
+    const uint8_t* cb = &components[1].plane[jpeg->row * components[1].v / jpeg->v * components[1].width];
+    const uint8_t* cr = &components[2].plane[jpeg->row * components[2].v / jpeg->v * components[2].width];
+    for (int i = 0; i < decoder->width; i++)
+    {
+        const int luma = y[i * components[0].h / jpeg->h] << 16;
+        const int blue = cb[i * components[1].h / jpeg->h] - 128;
+        const int red = cr[i * components[2].h / jpeg->h] - 128;
+        const int r = (luma + 91881 * red + 32768) >> 16;
+        const int g = (luma - 22554 * blue - 46802 * red + 32768) >> 16;
+        const int b = (luma + 116130 * blue + 32768) >> 16;
+        row[i * 3 + 0] = SDL_clamp(r, 0, 255);
+        row[i * 3 + 1] = SDL_clamp(g, 0, 255);
+        row[i * 3 + 2] = SDL_clamp(b, 0, 255);
+    }
+    jpeg->row++;
+    return true;
+}
+
+decoder_t* decoder_open(
+    const char* path,
+    int* width,
+    int* height)
+{
+    assert(path);
+    assert(width);
+    assert(height);
+    decoder_t* decoder = calloc(1, sizeof(decoder_t));
+    if (!decoder)
+    {
+        SDL_Log("Failed to allocate decoder");
+        return NULL;
+    }
+    decoder->io = SDL_IOFromFile(path, "rb");
+    if (!decoder->io)
+    {
+        free(decoder);
+        return NULL;
+    }
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t header[8];
+    for (int i = 0; i < 8; i++)
+    {
+        header[i] = read_byte(decoder);
+    }
+    bool opened = false;
+    if (!memcmp(header, signature, 8))
+    {
+        decoder->is_png = true;
+        opened = open_png(decoder);
+    }
+    else if (header[0] == 0xFF && header[1] == 0xD8)
+    {
+        decoder->position -= 6;
+        opened = open_jpeg(decoder);
+    }
+    if (!opened)
+    {
+        decoder_close(decoder);
+        return NULL;
+    }
+    *width = decoder->width;
+    *height = decoder->height;
+    return decoder;
+}
+
+bool decoder_read(
+    decoder_t* decoder,
+    uint8_t* row)
+{
+    assert(decoder);
+    assert(row);
+    if (decoder->y == decoder->height)
+    {
+        return false;
+    }
+    decoder->y++;
+    if (decoder->is_png)
+    {
+        return read_png(decoder, row);
+    }
+    return read_jpeg(decoder, row);
+}
+
+void decoder_close(
+    decoder_t* decoder)
+{
+    if (!decoder)
+    {
+        return;
+    }
+    free(decoder->png.current);
+    free(decoder->png.previous);
+    for (int i = 0; i < 3; i++)
+    {
+        free(decoder->jpeg.components[i].plane);
+    }
+    SDL_CloseIO(decoder->io);
+    free(decoder);
+}
\ No newline at end of file
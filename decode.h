@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct decoder decoder_t;
+
+decoder_t* decoder_open(
+    const char* path,
+    int* width,
+    int* height);
+bool decoder_read(
+    decoder_t* decoder,
+    uint8_t* row);
+void decoder_close(
+    decoder_t* decoder);
\ No newline at end of file
@@ -0,0 +1,35 @@
+#version 450
+
+#include "config.h"
+
+#if TRAIL_LAYERS > 4
+#error "deposit.frag writes at most four trail layers"
+#endif
+
+layout(location = 0) flat in uint i_color;
+layout(location = 0) out vec4 o_trail1;
+#if TRAIL_LAYERS > 1
+layout(location = 1) out vec4 o_trail2;
+#endif
+#if TRAIL_LAYERS > 2
+layout(location = 2) out vec4 o_trail3;
+#endif
+#if TRAIL_LAYERS > 3
+layout(location = 3) out vec4 o_trail4;
+#endif
+
+void main()
+{
+    /* Blended additively so every agent landing on a texel is counted */
+    const vec4 trail = vec4(equal(uvec4(i_color % 4), uvec4(0, 1, 2, 3))) * TRAIL_WEIGHT;
+    o_trail1 = i_color / 4 == 0 ? trail : vec4(0.0f);
+#if TRAIL_LAYERS > 1
+    o_trail2 = i_color / 4 == 1 ? trail : vec4(0.0f);
+#endif
+#if TRAIL_LAYERS > 2
+    o_trail3 = i_color / 4 == 2 ? trail : vec4(0.0f);
+#endif
+#if TRAIL_LAYERS > 3
+    o_trail4 = i_color / 4 == 3 ? trail : vec4(0.0f);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 450
+
+#include "config.h"
+
+struct agent_t
+{
+    vec2 position;
+    float angle;
+    uint color;
+};
+
+layout(location = 0) flat out uint o_color;
+layout(set = 0, binding = 0) readonly buffer t_agents
+{
+    agent_t b_agents[];
+};
+
+void main()
+{
+    const agent_t agent = b_agents[gl_VertexIndex];
+    const vec2 texel = vec2(ivec2(agent.position)) + 0.5f;
+    gl_Position = vec4(texel.x / WIDTH * 2.0f - 1.0f, 1.0f - texel.y / HEIGHT * 2.0f, 0.0f, 1.0f);
+    gl_PointSize = 1.0f;
+    o_color = agent.color;
+}
\ No newline at end of file
@@ -1,9 +1,8 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <stb_image.h>
-#include <stb_image_resize.h>
 #include <stdbool.h>
-#include <float.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,197 +10,1259 @@
 #include <string.h>
 #include <time.h>
 #include "config.h"
+#include "decode.h"
+#include "palette.h"
+#include "sim.h"
 #include "util.h"
+#include "video.h"
+
+#define SNAPSHOT_COUNT 3
+#define SNAPSHOT_FRESH 4
+
+static SDL_Window* window;
+static SDL_GPUDevice* device;
+static sim_t sim;
+static trail_format_t format;
+static int compare_steps;
+static int species_count = COLOR_COUNT;
+static int agent_count;
+static bool perceptual;
+static int sort_interval = SORT_INTERVAL;
+static int sort_frame;
+static int headless_steps;
+static const char* output = "png2slime.bmp";
+static int output_interval;
+static bool loaded;
+static SDL_Thread* ingest_thread;
+static SDL_AtomicInt ingest_done;
+static char* ingest_path;
+static char* ingest_pending;
+static uint8_t* ingest_species;
+static palette_t ingest_palette;
+static const char* video_path;
+static int video_fps = 30;
+static SDL_Thread* video_thread;
+static SDL_AtomicInt video_ready;
+static SDL_AtomicInt video_quit;
+static SDL_Mutex* video_mutex;
+static SDL_Condition* video_condition;
+static uint8_t* video_species;
+static palette_t video_palette;
+static uint64_t video_time;
+static int substeps = 1;
+static int fast_forward_steps;
+static int fast_forward_remaining;
+static uint64_t step;
+static double step_time;
+static uint64_t profile_start;
+static uint64_t profile_time;
+static uint32_t profile_frames;
+static uint64_t sort_before_time;
+static uint64_t sort_after_time;
+static uint32_t sort_before_frames;
+static uint32_t sort_after_frames;
+static Uint32 wake_event;
+static bool occluded;
+static int max_fps;
+static int background_fps;
+static uint64_t frame_time;
+static SDL_Thread* sim_thread;
+static SDL_Mutex* sim_mutex;
+static SDL_Condition* sim_condition;
+static bool sim_stop;
+static SDL_AtomicInt render_waiting;
+static sim_snapshot_t snapshots[SNAPSHOT_COUNT];
+static SDL_AtomicInt snapshot_slot;
+static int snapshot_back;
+static int snapshot_front;
+static bool shown;
+static bool dirty;
+static SDL_GPUPresentMode present_mode = SDL_GPU_PRESENTMODE_VSYNC;
+static int frames_in_flight = 2;
+static const char* latency_path;
+static SDL_IOStream* latency_stream;
+static SDL_GPUFence* latency_fences[MAX_FRAMES_IN_FLIGHT];
+static uint64_t latency_submits[MAX_FRAMES_IN_FLIGHT];
+static uint64_t latency_frames[MAX_FRAMES_IN_FLIGHT];
+static int latency_count;
+static SDL_Thread* latency_thread;
+static SDL_Mutex* latency_mutex;
+static SDL_Condition* latency_condition;
+static bool latency_stop;
+static uint64_t latency_frame;
+static uint64_t latency_sum;
+static uint64_t latency_max;
+static uint64_t latency_samples;
+static bool sense_direct;
+static bool profile;
+
+static void compare(const uint8_t* species, const palette_t* palette, uint32_t seed)
+{
+    sim_t sims[2] = {0};
+    float* trails[2] = {0};
+    const trail_format_t formats[2] = {TRAIL_FORMAT_F32, format};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!sim_create(&sims[i], formats[i], species, palette, agent_count, seed))
+        {
+            SDL_Log("Failed to create simulation");
+            goto cleanup;
+        }
+    }
+    /* Both simulations see the same seeds and timestep so only precision differs */
+    for (int i = 0; i < compare_steps; i++)
+    {
+        SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            goto cleanup;
+        }
+        for (int j = 0; j < 2; j++)
+        {
+            if (!sim_sense(cb, &sims[j], sense_direct, i, TIMESTEP) || !sim_blur(cb, &sims[j]))
+            {
+                SDL_SubmitGPUCommandBuffer(cb);
+                goto cleanup;
+            }
+        }
+        SDL_SubmitGPUCommandBuffer(cb);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        trails[i] = sim_read_trail(&sims[i]);
+        if (!trails[i])
+        {
+            SDL_Log("Failed to read trail");
+            goto cleanup;
+        }
+    }
+    SDL_Log("Comparing %s to f32 after %d steps", sim_get_format_name(format), compare_steps);
+    for (int i = 0; i < palette->count; i++)
+    {
+        double sum = 0.0;
+        double error = 0.0;
+        double highest = 0.0;
+        for (int j = 0; j < WIDTH * HEIGHT; j++)
+        {
+            const int index = (i / 4 * WIDTH * HEIGHT + j) * 4 + i % 4;
+            const double difference = SDL_fabs(trails[1][index] - trails[0][index]);
+            sum += trails[0][index];
+            error += difference;
+            highest = SDL_max(highest, difference);
+        }
+        SDL_Log("Species %d: mean %f, mean error %f, max error %f", i,
+            sum / (WIDTH * HEIGHT), error / (WIDTH * HEIGHT), highest);
+    }
+cleanup:
+    for (int i = 0; i < 2; i++)
+    {
+        free(trails[i]);
+        sim_destroy(&sims[i]);
+    }
+}
 
 typedef struct
 {
-    float x;
-    float y;
-    float angle;
-    uint32_t color;
+    decoder_t* decoder;
+    stbi_uc* pixels;
+    uint8_t* row;
+    int width;
+    int height;
+    int y;
+}
+source_t;
+
+static bool open_source(
+    source_t* source,
+    const char* path)
+{
+    /* PNG and baseline JPEG stream row by row, anything else is decoded whole */
+    memset(source, 0, sizeof(source_t));
+    source->y = -1;
+    source->decoder = decoder_open(path, &source->width, &source->height);
+    if (source->decoder)
+    {
+        source->row = malloc((size_t) source->width * 3);
+        if (!source->row)
+        {
+            SDL_Log("Failed to allocate row");
+            decoder_close(source->decoder);
+            return false;
+        }
+        return true;
+    }
+    int channels;
+    source->pixels = stbi_load(path, &source->width, &source->height, &channels, 3);
+    if (!source->pixels)
+    {
+        SDL_Log("Failed to load image: %s", path);
+        return false;
+    }
+    return true;
+}
+
+static const uint8_t* read_source(
+    source_t* source,
+    int y)
+{
+    /* Rows are only ever requested in order, so the decoder just reads forward */
+    if (source->pixels)
+    {
+        return &source->pixels[(size_t) y * source->width * 3];
+    }
+    while (source->y < y)
+    {
+        if (!decoder_read(source->decoder, source->row))
+        {
+            return NULL;
+        }
+        source->y++;
+    }
+    return source->row;
+}
+
+static void close_source(
+    source_t* source)
+{
+    if (source->decoder)
+    {
+        decoder_close(source->decoder);
+    }
+    stbi_image_free(source->pixels);
+    free(source->row);
+}
+
+static size_t get_cache_size(
+    uint32_t sites)
+{
+    /* The palette comes first and one spare byte lets unpacking always read two bytes */
+    return sizeof(palette_t) + ((size_t) sites * CACHE_BITS + 7) / 8 + 1;
+}
+
+static bool hash_file(
+    const char* path,
+    uint64_t* hash)
+{
+    /* FNV-1a over the raw bytes, reading the file is far cheaper than decoding it */
+    SDL_IOStream* stream = SDL_IOFromFile(path, "rb");
+    if (!stream)
+    {
+        SDL_Log("Failed to open file: %s", SDL_GetError());
+        return false;
+    }
+    uint8_t buffer[65536];
+    size_t size;
+    *hash = 0xCBF29CE484222325;
+    while ((size = SDL_ReadIO(stream, buffer, sizeof(buffer))) > 0)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            *hash = (*hash ^ buffer[i]) * 0x100000001B3;
+        }
+    }
+    const bool success = SDL_GetIOStatus(stream) == SDL_IO_STATUS_EOF;
+    SDL_CloseIO(stream);
+    return success;
+}
+
+static bool get_cache_path(
+    char* path,
+    int size,
+    uint64_t hash)
+{
+    char* pref = SDL_GetPrefPath(NULL, "png2slime");
+    if (!pref)
+    {
+        SDL_Log("Failed to get pref path: %s", SDL_GetError());
+        return false;
+    }
+    /* The layout is part of the name so other sizes never read a stale map */
+    SDL_snprintf(path, size, "%scache", pref);
+    SDL_CreateDirectory(path);
+    SDL_snprintf(path, size, "%scache/%016" SDL_PRIx64 "_%dx%d_%d_%d%s.bin",
+        pref, hash, WIDTH, HEIGHT, SPACING, species_count, perceptual ? "_lab" : "");
+    SDL_free(pref);
+    return true;
+}
+
+static uint8_t* load_cache(
+    const char* path,
+    palette_t* palette,
+    uint32_t sites)
+{
+    size_t size;
+    uint8_t* data = SDL_LoadFile(path, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+    /* The size is checked first so a truncated file is never read past its end */
+    if (size != get_cache_size(sites))
+    {
+        SDL_free(data);
+        return NULL;
+    }
+    memcpy(palette, data, sizeof(palette_t));
+    if (!palette->count || palette->count > COLOR_COUNT)
+    {
+        SDL_free(data);
+        return NULL;
+    }
+    uint8_t* species = malloc(sites);
+    if (!species)
+    {
+        SDL_Log("Failed to allocate species");
+        SDL_free(data);
+        return NULL;
+    }
+    /* Sites are packed 3 bits each, least significant first */
+    const uint8_t* bits = data + sizeof(palette_t);
+    for (uint32_t i = 0; i < sites; i++)
+    {
+        const uint32_t bit = i * CACHE_BITS;
+        const uint32_t value = bits[bit / 8] | bits[bit / 8 + 1] << 8;
+        species[i] = (value >> (bit % 8)) & ((1 << CACHE_BITS) - 1);
+        if (species[i] >= palette->count)
+        {
+            free(species);
+            SDL_free(data);
+            return NULL;
+        }
+    }
+    SDL_free(data);
+    return species;
+}
+
+static void save_cache(
+    const char* path,
+    const uint8_t* species,
+    const palette_t* palette,
+    uint32_t sites)
+{
+    uint8_t* data = calloc(get_cache_size(sites), 1);
+    if (!data)
+    {
+        SDL_Log("Failed to allocate cache");
+        return;
+    }
+    memcpy(data, palette, sizeof(palette_t));
+    uint8_t* bits = data + sizeof(palette_t);
+    for (uint32_t i = 0; i < sites; i++)
+    {
+        const uint32_t bit = i * CACHE_BITS;
+        bits[bit / 8] |= species[i] << (bit % 8);
+        bits[bit / 8 + 1] |= species[i] >> (8 - bit % 8);
+    }
+    if (!SDL_SaveFile(path, data, get_cache_size(sites)))
+    {
+        SDL_Log("Failed to save cache: %s", SDL_GetError());
+    }
+    free(data);
+}
+
+static uint8_t* average(const char* path)
+{
+    source_t source;
+    if (!open_source(&source, path))
+    {
+        return NULL;
+    }
+    const uint32_t w = source.width;
+    const uint32_t h = source.height;
+    uint8_t* colors = malloc(SITES * 3);
+    uint32_t* starts = malloc((COLUMNS + 1) * sizeof(uint32_t));
+    uint32_t* sums = malloc(COLUMNS * 3 * sizeof(uint32_t));
+    if (!colors || !starts || !sums)
+    {
+        SDL_Log("Failed to allocate colors");
+        close_source(&source);
+        free(colors);
+        free(starts);
+        free(sums);
+        return NULL;
+    }
+    /* Each site averages the source pixels under its SPACING x SPACING cell */
+    for (uint32_t i = 0; i < COLUMNS; i++)
+    {
+        starts[i] = (uint64_t) i * SPACING * w / WIDTH;
+    }
+    starts[COLUMNS] = w;
+    for (uint32_t i = 0; i < ROWS; i++)
+    {
+        const uint32_t y1 = (uint64_t) i * SPACING * h / HEIGHT;
+        const uint32_t y2 = SDL_max(y1 + 1, (uint64_t) SDL_min((i + 1) * SPACING, HEIGHT) * h / HEIGHT);
+        memset(sums, 0, COLUMNS * 3 * sizeof(uint32_t));
+        for (uint32_t y = y1; y < y2; y++)
+        {
+            const uint8_t* line = read_source(&source, y);
+            if (!line)
+            {
+                SDL_Log("Failed to decode image: %s", path);
+                close_source(&source);
+                free(colors);
+                free(starts);
+                free(sums);
+                return NULL;
+            }
+            for (uint32_t j = 0; j < COLUMNS; j++)
+            {
+                const uint32_t x2 = SDL_max(starts[j] + 1, starts[j + 1]);
+                for (uint32_t x = starts[j]; x < x2; x++)
+                {
+                    sums[j * 3 + 0] += line[x * 3 + 0];
+                    sums[j * 3 + 1] += line[x * 3 + 1];
+                    sums[j * 3 + 2] += line[x * 3 + 2];
+                }
+            }
+        }
+        for (uint32_t j = 0; j < COLUMNS; j++)
+        {
+            const uint32_t count = (y2 - y1) * (SDL_max(starts[j] + 1, starts[j + 1]) - starts[j]);
+            uint8_t* color = &colors[(i * COLUMNS + j) * 3];
+            color[0] = sums[j * 3 + 0] / count;
+            color[1] = sums[j * 3 + 1] / count;
+            color[2] = sums[j * 3 + 2] / count;
+        }
+    }
+    close_source(&source);
+    free(starts);
+    free(sums);
+    return colors;
+}
+
+/* Species of every RGB555 color (red in the low bits) so classifying a site is a single load */
+/* Only one image is classified at a time, on the ingest or video thread or before either exists */
+static uint8_t lut[1 << 15];
+static palette_t lut_palette;
+static bool lut_perceptual;
+
+static void map_species(
+    const uint8_t* colors,
+    const palette_t* palette,
+    uint8_t* species)
+{
+    if (memcmp(&lut_palette, palette, sizeof(palette_t)) || lut_perceptual != perceptual)
+    {
+        palette_create_lut(palette, perceptual, lut);
+        lut_palette = *palette;
+        lut_perceptual = perceptual;
+    }
+    for (uint32_t i = 0; i < SITES; i++)
+    {
+        const uint8_t* color = &colors[i * 3];
+        species[i] = lut[(color[0] >> 3) | (color[1] >> 3) << 5 | (color[2] >> 3) << 10];
+    }
+}
+
+static uint8_t* classify(
+    const char* path,
+    palette_t* palette)
+{
+    uint8_t* colors = average(path);
+    if (!colors)
+    {
+        return NULL;
+    }
+    /* The palette is clustered from the site colors so every species covers part of the image */
+    uint8_t* species = malloc(SITES);
+    if (!species || !palette_cluster(palette, colors, SITES, species_count))
+    {
+        SDL_Log("Failed to create palette");
+        free(colors);
+        free(species);
+        return NULL;
+    }
+    SDL_Log("Clustered %u species", palette->count);
+    map_species(colors, palette, species);
+    free(colors);
+    return species;
+}
+
+static uint8_t* load_species(
+    const char* path,
+    palette_t* palette)
+{
+    /* Reloading the same image only needs the species map, not another decode */
+    char cache[1024];
+    uint64_t hash;
+    if (!hash_file(path, &hash) || !get_cache_path(cache, sizeof(cache), hash))
+    {
+        return classify(path, palette);
+    }
+    uint8_t* species = load_cache(cache, palette, SITES);
+    if (species)
+    {
+        SDL_Log("Loaded cache: %s", cache);
+        return species;
+    }
+    species = classify(path, palette);
+    if (species)
+    {
+        save_cache(cache, species, palette, SITES);
+    }
+    return species;
+}
+
+static bool create(
+    const uint8_t* species,
+    const palette_t* palette,
+    SDL_Mutex* mutex)
+{
+    /* Agents are spawned on the GPU from the species of each site */
+    const uint32_t seed = rand();
+    /* With a sim thread, everything that touches the resource pool in sim.c runs under its lock */
+    if (mutex)
+    {
+        SDL_LockMutex(mutex);
+    }
+    if (compare_steps > 0 && format != TRAIL_FORMAT_F32)
+    {
+        compare(species, palette, seed);
+    }
+    /* The current simulation is only replaced once the new one exists */
+    sim_t next;
+    if (!sim_create(&next, format, species, palette, agent_count, seed))
+    {
+        SDL_Log("Failed to create simulation");
+        sim_destroy(&next);
+        if (mutex)
+        {
+            SDL_UnlockMutex(mutex);
+        }
+        return false;
+    }
+    sim_destroy(&sim);
+    sim = next;
+    sort_frame = 0;
+    step = 0;
+    fast_forward_remaining = fast_forward_steps;
+    loaded = true;
+    if (mutex)
+    {
+        SDL_SignalCondition(sim_condition);
+        SDL_UnlockMutex(mutex);
+    }
+    return true;
+}
+
+static bool reload(
+    const char* path,
+    SDL_Mutex* mutex)
+{
+    palette_t palette;
+    uint8_t* species = load_species(path, &palette);
+    if (!species)
+    {
+        return false;
+    }
+    const bool created = create(species, &palette, mutex);
+    free(species);
+    return created;
+}
+
+static void wake(void)
+{
+    /* Workers push an event so a main loop blocked on events picks up their results */
+    SDL_Event event = {0};
+    event.type = wake_event;
+    SDL_PushEvent(&event);
+}
+
+static int SDLCALL ingest(void* data)
+{
+    /* Decoding and classifying runs here while the main thread keeps rendering */
+    ingest_species = load_species(ingest_path, &ingest_palette);
+    SDL_SetAtomicInt(&ingest_done, 1);
+    wake();
+    return 0;
+}
+
+static void start_ingest(const char* path)
+{
+    /* Only the latest drop is kept while an image is still loading */
+    if (ingest_thread)
+    {
+        SDL_free(ingest_pending);
+        ingest_pending = SDL_strdup(path);
+        return;
+    }
+    SDL_free(ingest_path);
+    ingest_path = SDL_strdup(path);
+    SDL_SetAtomicInt(&ingest_done, 0);
+    ingest_thread = SDL_CreateThread(ingest, "ingest", NULL);
+    if (!ingest_thread)
+    {
+        SDL_Log("Failed to create thread: %s", SDL_GetError());
+        reload(path, sim_mutex);
+    }
+}
+
+static void poll_ingest(void)
+{
+    if (!ingest_thread || !SDL_GetAtomicInt(&ingest_done))
+    {
+        return;
+    }
+    SDL_WaitThread(ingest_thread, NULL);
+    ingest_thread = NULL;
+    if (ingest_species)
+    {
+        create(ingest_species, &ingest_palette, sim_mutex);
+        free(ingest_species);
+        ingest_species = NULL;
+    }
+    if (ingest_pending)
+    {
+        char* path = ingest_pending;
+        ingest_pending = NULL;
+        start_ingest(path);
+        SDL_free(path);
+    }
+}
+
+static int compare_files(const void* a, const void* b)
+{
+    return strcmp(*(const char**) a, *(const char**) b);
+}
+
+static bool read_video(
+    video_t* video,
+    char** files,
+    int file_count,
+    int* file,
+    uint8_t* colors)
+{
+    if (video)
+    {
+        return video_read(video, colors);
+    }
+    /* Frames that fail to load are skipped */
+    while (*file < file_count)
+    {
+        char path[1024];
+        SDL_snprintf(path, sizeof(path), "%s/%s", video_path, files[(*file)++]);
+        uint8_t* frame = average(path);
+        if (frame)
+        {
+            memcpy(colors, frame, SITES * 3);
+            free(frame);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int SDLCALL play(void* data)
+{
+    /* Frames are averaged and classified here so the main thread only patches what changed */
+    video_t* video = NULL;
+    char** files = NULL;
+    int file_count = 0;
+    int file = 0;
+    SDL_PathInfo info;
+    if (strcmp(video_path, "-") && SDL_GetPathInfo(video_path, &info) && info.type == SDL_PATHTYPE_DIRECTORY)
+    {
+        files = SDL_GlobDirectory(video_path, NULL, 0, &file_count);
+        if (!files)
+        {
+            SDL_Log("Failed to list directory: %s", SDL_GetError());
+            return 0;
+        }
+        SDL_qsort(files, file_count, sizeof(char*), compare_files);
+    }
+    else if (!(video = video_open(video_path)))
+    {
+        return 0;
+    }
+    uint8_t* colors = malloc(SITES * 3);
+    uint8_t* species = malloc(SITES);
+    if (!colors || !species)
+    {
+        SDL_Log("Failed to allocate frame");
+    }
+    /* The palette comes from the first frame so species stay comparable between frames */
+    bool clustered = false;
+    while (colors && species && !SDL_GetAtomicInt(&video_quit) &&
+        read_video(video, files, file_count, &file, colors))
+    {
+        if (!clustered && !palette_cluster(&video_palette, colors, SITES, species_count))
+        {
+            break;
+        }
+        clustered = true;
+        map_species(colors, &video_palette, species);
+        /* Quitting is only decided under the lock, so the species are never written after it */
+        SDL_LockMutex(video_mutex);
+        while (SDL_GetAtomicInt(&video_ready) && !SDL_GetAtomicInt(&video_quit))
+        {
+            SDL_WaitCondition(video_condition, video_mutex);
+        }
+        if (!SDL_GetAtomicInt(&video_quit))
+        {
+            memcpy(video_species, species, SITES);
+            SDL_SetAtomicInt(&video_ready, 1);
+            wake();
+        }
+        SDL_UnlockMutex(video_mutex);
+    }
+    SDL_Log("Video ended");
+    video_close(video);
+    SDL_free(files);
+    free(colors);
+    free(species);
+    return 0;
+}
+
+static bool start_video(void)
+{
+    video_species = malloc(SITES);
+    if (!video_species)
+    {
+        SDL_Log("Failed to allocate species");
+        return false;
+    }
+    video_mutex = SDL_CreateMutex();
+    video_condition = SDL_CreateCondition();
+    if (!video_mutex || !video_condition)
+    {
+        SDL_Log("Failed to create mutex: %s", SDL_GetError());
+        return false;
+    }
+    video_thread = SDL_CreateThread(play, "video", NULL);
+    if (!video_thread)
+    {
+        SDL_Log("Failed to create thread: %s", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+static void poll_video(void)
+{
+    if (!video_thread || !SDL_GetAtomicInt(&video_ready))
+    {
+        return;
+    }
+    const uint64_t time = SDL_GetTicksNS();
+    if (loaded && time - video_time < SDL_NS_PER_SECOND / video_fps)
+    {
+        return;
+    }
+    video_time = time;
+    /* The first frame creates the simulation and later ones only recolor changed sites */
+    if (!loaded)
+    {
+        create(video_species, &video_palette, sim_mutex);
+    }
+    else
+    {
+        SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            return;
+        }
+        SDL_LockMutex(sim_mutex);
+        sim_reseed(cb, &sim, video_species);
+        SDL_SubmitGPUCommandBuffer(cb);
+        SDL_UnlockMutex(sim_mutex);
+    }
+    SDL_LockMutex(video_mutex);
+    SDL_SetAtomicInt(&video_ready, 0);
+    SDL_SignalCondition(video_condition);
+    SDL_UnlockMutex(video_mutex);
+}
+
+static bool simulate(
+    SDL_GPUCommandBuffer** cb,
+    SDL_Mutex* mutex)
+{
+    /* One fixed step, seeded by its index. On failure the command buffer is submitted */
+    if (sort_interval > 0 && sort_frame >= sort_interval)
+    {
+        if (!sim_sort(*cb, &sim))
+        {
+            SDL_SubmitGPUCommandBuffer(*cb);
+            return false;
+        }
+        sort_frame = 0;
+    }
+    if (profile)
+    {
+        /* Isolate the sensing work so the fence only covers it, without holding the caller's lock */
+        SDL_SubmitGPUCommandBuffer(*cb);
+        if (mutex)
+        {
+            SDL_UnlockMutex(mutex);
+        }
+        SDL_WaitForGPUIdle(device);
+        if (mutex)
+        {
+            SDL_LockMutex(mutex);
+        }
+        *cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!*cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            return false;
+        }
+    }
+    const uint64_t t1 = SDL_GetPerformanceCounter();
+    if (!sim_sense(*cb, &sim, sense_direct, step, TIMESTEP))
+    {
+        SDL_SubmitGPUCommandBuffer(*cb);
+        return false;
+    }
+    if (profile)
+    {
+        SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(*cb);
+        if (!fence)
+        {
+            SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+            return false;
+        }
+        if (mutex)
+        {
+            SDL_UnlockMutex(mutex);
+        }
+        SDL_WaitForGPUFences(device, true, &fence, 1);
+        SDL_ReleaseGPUFence(device, fence);
+        if (mutex)
+        {
+            SDL_LockMutex(mutex);
+        }
+        const uint64_t t2 = SDL_GetPerformanceCounter();
+        const uint64_t elapsed = t2 - t1;
+        profile_time += elapsed;
+        profile_frames++;
+        /* Compare the steps right after a sort to the ones right before it */
+        if (sort_interval > 0 && sort_frame < SORT_SAMPLES)
+        {
+            sort_after_time += elapsed;
+            sort_after_frames++;
+            if (sort_after_frames == SORT_SAMPLES && sort_before_frames)
+            {
+                const double before = sort_before_time * 1000.0 / SDL_GetPerformanceFrequency();
+                const double after = sort_after_time * 1000.0 / SDL_GetPerformanceFrequency();
+                SDL_Log("Sorting: %f ms before, %f ms after",
+                    before / sort_before_frames, after / sort_after_frames);
+            }
+            if (sort_after_frames == SORT_SAMPLES)
+            {
+                sort_before_time = 0;
+                sort_after_time = 0;
+                sort_before_frames = 0;
+                sort_after_frames = 0;
+            }
+        }
+        else if (sort_interval > 0 && sort_frame >= sort_interval - SORT_SAMPLES)
+        {
+            sort_before_time += elapsed;
+            sort_before_frames++;
+        }
+        if (t2 - profile_start >= SDL_GetPerformanceFrequency())
+        {
+            const double ms = profile_time * 1000.0 / SDL_GetPerformanceFrequency();
+            SDL_Log("Sensing (%s): %f ms", sense_direct ? "direct" : "sat", ms / profile_frames);
+            profile_start = t2;
+            profile_time = 0;
+            profile_frames = 0;
+        }
+        *cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!*cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            return false;
+        }
+    }
+    sort_frame++;
+    step++;
+    if (!sim_blur(*cb, &sim))
+    {
+        SDL_SubmitGPUCommandBuffer(*cb);
+        return false;
+    }
+    return true;
+}
+
+static void run_fast_forward(void)
+{
+    /* Batches of steps without drawing, waiting on each so cycled textures don't pile up */
+    SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+    if (!cb)
+    {
+        SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+        return;
+    }
+    const int steps = SDL_min(fast_forward_remaining, FAST_FORWARD_BATCH);
+    for (int i = 0; i < steps; i++)
+    {
+        if (!simulate(&cb, sim_mutex))
+        {
+            fast_forward_remaining = 0;
+            return;
+        }
+    }
+    fast_forward_remaining -= steps;
+    SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+    if (!fence)
+    {
+        SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+        return;
+    }
+    /* Called with the lock held, which is dropped so the render thread can take it meanwhile */
+    SDL_UnlockMutex(sim_mutex);
+    SDL_WaitForGPUFences(device, true, &fence, 1);
+    SDL_ReleaseGPUFence(device, fence);
+    SDL_LockMutex(sim_mutex);
+    if (!fast_forward_remaining)
+    {
+        SDL_Log("Fast-forwarded to step %llu", (unsigned long long) step);
+    }
 }
-agent_t;
 
-static SDL_Window* window;
-static SDL_GPUDevice* device;
-static SDL_GPUComputePipeline* update_pipeline;
-static SDL_GPUComputePipeline* blur_pipeline;
-static SDL_GPUGraphicsPipeline* draw_pipeline;
-static SDL_GPUBuffer* agent_buffer;
-static SDL_GPUTexture* trail_texture1;
-static SDL_GPUTexture* trail_texture2;
-static SDL_GPUSampler* sampler;
-static bool loaded;
+static bool save_frame(int index)
+{
+    /* Frames get the step number inserted before the extension */
+    char path[1024];
+    const char* extension = strrchr(output, '.');
+    const int length = extension ? extension - output : (int) strlen(output);
+    SDL_snprintf(path, sizeof(path), "%.*s_%06d%s", length, output, index, extension ? extension : "");
+    return sim_save(&sim, path);
+}
 
-static bool reload(const char* path)
+static bool headless(void)
 {
-    loaded = false;
-    srand(time(NULL));
-    SDL_ReleaseGPUBuffer(device, agent_buffer);
-    SDL_ReleaseGPUTexture(device, trail_texture1);
-    SDL_ReleaseGPUTexture(device, trail_texture2);
-    agent_buffer = NULL;
-    trail_texture1 = NULL;
-    trail_texture2 = NULL;
-    int channels;
-    int w;
-    int h;
-    stbi_uc* src = stbi_load(path, &w, &h, &channels, 3);
-    if (!src)
+    /* Steps are fixed and seeded by their index so runs are reproducible */
+    SDL_GPUFence* fence = NULL;
+    int i = 0;
+    for (; i < headless_steps; i++)
     {
-        SDL_Log("Failed to load image: %s", path);
+        SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            break;
+        }
+        if (!simulate(&cb, NULL))
+        {
+            break;
+        }
+        /* Keep one step in flight so cycled textures don't pile up */
+        if (fence)
+        {
+            SDL_WaitForGPUFences(device, true, &fence, 1);
+            SDL_ReleaseGPUFence(device, fence);
+        }
+        fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+        if (!fence)
+        {
+            SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+            break;
+        }
+        if (output_interval > 0 && (i + 1) % output_interval == 0 && !save_frame(i + 1))
+        {
+            break;
+        }
+    }
+    if (fence)
+    {
+        SDL_WaitForGPUFences(device, true, &fence, 1);
+        SDL_ReleaseGPUFence(device, fence);
+    }
+    if (i < headless_steps)
+    {
+        SDL_Log("Failed at step %d", i);
         return false;
     }
-    channels = 3;
-    stbi_uc* dst = malloc(WIDTH * HEIGHT * channels);
-    if (!dst)
+    if (!sim_save(&sim, output))
     {
-        SDL_Log("Failed to allocate image");
         return false;
     }
-    if (!stbir_resize_uint8(src, w, h, 0, dst, WIDTH, HEIGHT, 0, channels))
+    SDL_Log("Saved image: %s", output);
+    return true;
+}
+
+static bool run_headless(const char* path, bool retune)
+{
+    if (!path)
     {
-        SDL_Log("Failed to resize image");
+        SDL_Log("Headless mode requires an image");
         return false;
     }
-    stbi_image_free(src);
-    const uint32_t colors[COLOR_COUNT] =
+    /* Vulkan devices need the video subsystem, the offscreen driver provides it without a display */
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+    if (!SDL_Init(SDL_INIT_VIDEO))
     {
-        0x0000FF, /* red */
-        0x00FF00, /* green */
-        0xFF0000, /* blue */
-        0xFFFFFF, /* white */
-        0xFF00FF, /* magenta */
-        0xFFFF00, /* cyan */
-        0x00FFFF, /* yellow */
-    };
-    agent_t* agents = malloc(WIDTH * HEIGHT * sizeof(agent_t));
-    if (!agents)
+        SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
+        return false;
+    }
+    /* No window or swapchain so this also runs on software drivers like lavapipe */
+    if (!(device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV, true, NULL)))
     {
-        SDL_Log("Failed to allocate agents");
+        SDL_Log("Failed to create device: %s", SDL_GetError());
         return false;
     }
-    for (uint32_t x = 0; x < WIDTH; x++)
-    for (uint32_t y = 0; y < HEIGHT; y++)
-    {
-        const uint32_t index = (y * WIDTH + x) * channels;
-        uint32_t color1 = 0;
-        color1 |= dst[index + 0] << 0;
-        color1 |= dst[index + 1] << 8;
-        color1 |= dst[index + 2] << 16;
-        double distance1 = DBL_MAX;
-        uint32_t color = UINT32_MAX;
-        for (uint32_t i = 0; i < COLOR_COUNT; i++)
-        {
-            const uint32_t color2 = colors[i];
-            const int r1 = (color1 >> 0) & 0xFF;
-            const int g1 = (color1 >> 8) & 0xFF;
-            const int b1 = (color1 >> 16) & 0xFF;
-            const int r2 = (color2 >> 0) & 0xFF;
-            const int g2 = (color2 >> 8) & 0xFF;
-            const int b2 = (color2 >> 16) & 0xFF;
-            const double distance2 =
-                (r1 - r2) * (r1 - r2) + 
-                (g1 - g2) * (g1 - g2) + 
-                (b1 - b2) * (b1 - b2);
-            if (distance2 < distance1)
-            {
-                distance1 = distance2;
-                color = i;
-            }
+    if (!sim_init(device, SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM))
+    {
+        SDL_Log("Failed to initialize simulation");
+        return false;
+    }
+    if (!sim_tune(retune))
+    {
+        SDL_Log("Using default workgroup sizes");
+    }
+    bool success = reload(path, NULL) && headless();
+    sim_destroy(&sim);
+    sim_quit();
+    SDL_DestroyGPUDevice(device);
+    SDL_Quit();
+    return success;
+}
+
+static bool parse_present_mode(
+    const char* name,
+    SDL_GPUPresentMode* mode)
+{
+    static const struct
+    {
+        const char* name;
+        SDL_GPUPresentMode mode;
+    }
+    modes[] =
+    {
+        {"vsync", SDL_GPU_PRESENTMODE_VSYNC},
+        {"mailbox", SDL_GPU_PRESENTMODE_MAILBOX},
+        {"immediate", SDL_GPU_PRESENTMODE_IMMEDIATE},
+    };
+    for (int i = 0; i < SDL_arraysize(modes); i++)
+    {
+        if (!strcmp(name, modes[i].name))
+        {
+            *mode = modes[i].mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int SDLCALL watch(void* data)
+{
+    /* Each fence is waited on as soon as it is submitted so a sample is only late by a wake up */
+    SDL_LockMutex(latency_mutex);
+    while (true)
+    {
+        while (!latency_count && !latency_stop)
+        {
+            SDL_WaitCondition(latency_condition, latency_mutex);
+        }
+        if (!latency_count)
+        {
+            break;
+        }
+        SDL_GPUFence* fence = latency_fences[0];
+        const uint64_t submit = latency_submits[0];
+        const uint64_t frame = latency_frames[0];
+        SDL_UnlockMutex(latency_mutex);
+        SDL_WaitForGPUFences(device, true, &fence, 1);
+        const uint64_t latency = SDL_GetTicksNS() - submit;
+        SDL_ReleaseGPUFence(device, fence);
+        latency_sum += latency;
+        latency_max = SDL_max(latency_max, latency);
+        latency_samples++;
+        if (latency_stream)
+        {
+            SDL_IOprintf(latency_stream, "%" SDL_PRIu64 ",%f\n", frame, latency / 1000000.0);
         }
-        agent_t* agent = &agents[y * WIDTH + x];
-        agent->x = x;
-        agent->y = y;
-        agent->angle = (float) rand() / RAND_MAX * SDL_PI_F * 2.0f;
-        agent->color = color;
+        SDL_LockMutex(latency_mutex);
+        latency_count--;
+        memmove(latency_fences, latency_fences + 1, latency_count * sizeof(latency_fences[0]));
+        memmove(latency_submits, latency_submits + 1, latency_count * sizeof(latency_submits[0]));
+        memmove(latency_frames, latency_frames + 1, latency_count * sizeof(latency_frames[0]));
+        SDL_BroadcastCondition(latency_condition);
     }
+    SDL_UnlockMutex(latency_mutex);
+    return 0;
+}
+
+static void submit_frame(SDL_GPUCommandBuffer* cb)
+{
+    SDL_LockMutex(latency_mutex);
+    while (latency_count == MAX_FRAMES_IN_FLIGHT)
+    {
+        SDL_WaitCondition(latency_condition, latency_mutex);
+    }
+    const uint64_t time = SDL_GetTicksNS();
+    SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+    if (!fence)
+    {
+        SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+        SDL_UnlockMutex(latency_mutex);
+        return;
+    }
+    latency_fences[latency_count] = fence;
+    latency_submits[latency_count] = time;
+    latency_frames[latency_count] = latency_frame++;
+    latency_count++;
+    SDL_BroadcastCondition(latency_condition);
+    SDL_UnlockMutex(latency_mutex);
+}
+
+static void advance(int steps)
+{
+    /* Called with the lock held, which is dropped while the GPU finishes the steps */
     SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
     if (!cb)
     {
         SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
-        return false;
+        return;
     }
-    SDL_GPUBufferCreateInfo bci = {0};
-    bci.size = WIDTH * HEIGHT * sizeof(agent_t);
-    bci.usage =
-        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ |
-        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE;
-    agent_buffer = SDL_CreateGPUBuffer(device, &bci);
-    if (!agent_buffer)
+    bool stepped = true;
+    for (int i = 0; i < steps && stepped; i++)
     {
-        SDL_Log("Failed to create buffer: %s", SDL_GetError());
-        return false;
+        stepped = simulate(&cb, sim_mutex);
     }
-    SDL_GPUTransferBufferCreateInfo tbci = {0};
-    tbci.size = bci.size;
-    tbci.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
-    SDL_GPUTransferBuffer* tbo = SDL_CreateGPUTransferBuffer(device, &tbci);
-    if (!tbo)
+    if (!stepped)
     {
-        SDL_Log("Failed to create transfer buffer: %s", SDL_GetError());
-        return false;
+        return;
     }
-    void* data = SDL_MapGPUTransferBuffer(device, tbo, false);
-    if (!data)
+    SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+    if (!fence)
     {
-        SDL_Log("Failed to map transfer buffer: %s", SDL_GetError());
-        return false;
+        SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+        return;
     }
-    memcpy(data, agents, bci.size);
-    SDL_UnmapGPUTransferBuffer(device, tbo);
-    SDL_GPUTransferBufferLocation tbl = {0};
-    SDL_GPUBufferRegion br = {0};
-    tbl.transfer_buffer = tbo;
-    br.buffer = agent_buffer;
-    br.size = bci.size;
-    SDL_GPUCopyPass* pass = SDL_BeginGPUCopyPass(cb);
-    if (!pass)
-    {
-        SDL_Log("Failed to begin copy pass: %s", SDL_GetError());
-        return false;
+    /* The last blur wrote the current trail, which is handed over once it finishes */
+    sim_publish(&sim, &snapshots[snapshot_back]);
+    SDL_UnlockMutex(sim_mutex);
+    SDL_WaitForGPUFences(device, true, &fence, 1);
+    SDL_ReleaseGPUFence(device, fence);
+    /* The finished snapshot goes into the slot and whichever one the slot held is written next */
+    snapshot_back = SDL_SetAtomicInt(&snapshot_slot, snapshot_back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+    if (SDL_CompareAndSwapAtomicInt(&render_waiting, 1, 0))
+    {
+        wake();
     }
-    SDL_UploadToGPUBuffer(pass, &tbl, &br, false);
-    SDL_EndGPUCopyPass(pass);
-    SDL_ReleaseGPUTransferBuffer(device, tbo);
-    SDL_GPUTextureCreateInfo tci = {0};
-    tci.type = SDL_GPU_TEXTURETYPE_3D;
-    tci.format = SDL_GPU_TEXTUREFORMAT_R32_FLOAT;
-    tci.usage =
-        SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_WRITE |
-        SDL_GPU_TEXTUREUSAGE_SAMPLER |
-        SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
-    tci.width = WIDTH;
-    tci.height = HEIGHT;
-    tci.layer_count_or_depth = COLOR_COUNT;
-    tci.num_levels = 1;
-    trail_texture1 = SDL_CreateGPUTexture(device, &tci);
-    trail_texture2 = SDL_CreateGPUTexture(device, &tci);
-    if (!trail_texture1 || !trail_texture2)
-    {
-        SDL_Log("Failed to create texture(s): %s", SDL_GetError());
-        return false;
+    SDL_LockMutex(sim_mutex);
+}
+
+static int SDLCALL run(void* data)
+{
+    /* Steps are submitted here at their own rate so a stalled present does not stall the simulation */
+    SDL_LockMutex(sim_mutex);
+    uint64_t time = SDL_GetTicksNS();
+    while (!sim_stop)
+    {
+        if (!loaded || (occluded && background_fps == 0))
+        {
+            SDL_WaitCondition(sim_condition, sim_mutex);
+            step_time = 0.0;
+            time = SDL_GetTicksNS();
+            continue;
+        }
+        if (fast_forward_remaining > 0)
+        {
+            run_fast_forward();
+            step_time = 0.0;
+            time = SDL_GetTicksNS();
+            continue;
+        }
+        /* Fixed steps, so a stall costs at most MAX_STEPS. A hidden window steps at the background rate */
+        const double interval = occluded ? 1.0 / background_fps : TIMESTEP;
+        const uint64_t now = SDL_GetTicksNS();
+        step_time += (double) (now - time) / SDL_NS_PER_SECOND;
+        time = now;
+        int steps = step_time / interval;
+        step_time -= steps * interval;
+        if (steps > MAX_STEPS)
+        {
+            steps = MAX_STEPS;
+            step_time = 0.0;
+        }
+        if (!steps)
+        {
+            /* Rounded up so the thread does not wake just before the next step and spin */
+            SDL_WaitConditionTimeout(sim_condition, sim_mutex, (Sint32) ((interval - step_time) * 1000.0) + 1);
+            continue;
+        }
+        advance(occluded ? steps : steps * substeps);
+    }
+    SDL_UnlockMutex(sim_mutex);
+    return 0;
+}
+
+static Sint32 get_timeout(void)
+{
+    /* Milliseconds the main loop may block on events, 0 to keep going and -1 until one arrives. */
+    /* Without a new snapshot or a window change there is nothing to draw */
+    const bool fresh = SDL_GetAtomicInt(&snapshot_slot) & SNAPSHOT_FRESH;
+    if (occluded || !(fresh || (dirty && shown)))
+    {
+        return -1;
     }
+    if (max_fps <= 0)
     {
-        SDL_GPUColorTargetInfo cti[2] = {0};
-        cti[0].texture = trail_texture1;
-        cti[0].load_op = SDL_GPU_LOADOP_CLEAR;
-        cti[0].store_op = SDL_GPU_STOREOP_STORE;
-        cti[1].texture = trail_texture2;
-        cti[1].load_op = SDL_GPU_LOADOP_CLEAR;
-        cti[1].store_op = SDL_GPU_STOREOP_STORE;
-        SDL_GPURenderPass* pass = SDL_BeginGPURenderPass(cb, cti, 2, NULL);
-        if (!pass)
+        return 0;
+    }
+    const uint64_t time = SDL_GetTicksNS();
+    if (frame_time <= time)
+    {
+        return 0;
+    }
+    /* Rounded up so the loop does not wake just before it is due and spin */
+    return (Sint32) ((frame_time - time + 999999) / 1000000);
+}
+
+static bool handle_event(const SDL_Event* event)
+{
+    switch (event->type)
+    {
+    case SDL_EVENT_QUIT:
+        return false;
+    case SDL_EVENT_WINDOW_MINIMIZED:
+    case SDL_EVENT_WINDOW_OCCLUDED:
+    case SDL_EVENT_WINDOW_HIDDEN:
+        SDL_LockMutex(sim_mutex);
+        occluded = true;
+        SDL_SignalCondition(sim_condition);
+        SDL_UnlockMutex(sim_mutex);
+        break;
+    case SDL_EVENT_WINDOW_RESIZED:
+        dirty = true;
+        break;
+    case SDL_EVENT_WINDOW_RESTORED:
+    case SDL_EVENT_WINDOW_EXPOSED:
+    case SDL_EVENT_WINDOW_SHOWN:
+        dirty = true;
+        SDL_LockMutex(sim_mutex);
+        occluded = false;
+        SDL_SignalCondition(sim_condition);
+        SDL_UnlockMutex(sim_mutex);
+        break;
+    case SDL_EVENT_DROP_FILE:
+        if (video_path)
         {
-            SDL_Log("Failed to begin render pass: %s", SDL_GetError());
-            return false;
+            SDL_Log("Ignoring dropped file while playing a video");
+            break;
+        }
+        start_ingest(event->drop.data);
+        break;
+    case SDL_EVENT_KEY_DOWN:
+        SDL_LockMutex(sim_mutex);
+        if (event->key.key == SDLK_S)
+        {
+            sense_direct = !sense_direct;
+            SDL_Log("Sensing: %s", sense_direct ? "direct" : "sat");
+        }
+        else if (event->key.key == SDLK_F)
+        {
+            fast_forward_remaining += SDL_max(fast_forward_steps, FAST_FORWARD_BATCH);
+            SDL_SignalCondition(sim_condition);
         }
-        SDL_EndGPURenderPass(pass);
+        SDL_UnlockMutex(sim_mutex);
+        break;
     }
-    SDL_SubmitGPUCommandBuffer(cb);
-    free(agents);
-    free(dst);
-    loaded = true;
     return true;
 }
 
@@ -209,6 +1270,121 @@ int main(int argc, char** argv)
 {
     SDL_SetLogPriorities(SDL_LOG_PRIORITY_VERBOSE);
     SDL_SetAppMetadata("png2slime", NULL, NULL);
+    srand(time(NULL));
+    const char* path = NULL;
+    bool retune = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--direct"))
+        {
+            sense_direct = true;
+        }
+        else if (!strcmp(argv[i], "--profile"))
+        {
+            profile = true;
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+        {
+            if (!sim_parse_format(argv[++i], &format))
+            {
+                SDL_Log("Unknown trail format: %s", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--compare") && i + 1 < argc)
+        {
+            compare_steps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--species") && i + 1 < argc)
+        {
+            species_count = SDL_clamp(atoi(argv[++i]), 1, COLOR_COUNT);
+        }
+        else if (!strcmp(argv[i], "--match") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "lab") || !strcmp(argv[i], "rgb"))
+            {
+                perceptual = !strcmp(argv[i], "lab");
+            }
+            else
+            {
+                SDL_Log("Unknown match mode: %s", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--agents") && i + 1 < argc)
+        {
+            agent_count = SDL_clamp(atoi(argv[++i]), 0, MAX_AGENTS);
+        }
+        else if (!strcmp(argv[i], "--video") && i + 1 < argc)
+        {
+            video_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+        {
+            video_fps = SDL_max(atoi(argv[++i]), 1);
+        }
+        else if (!strcmp(argv[i], "--substeps") && i + 1 < argc)
+        {
+            substeps = SDL_max(atoi(argv[++i]), 1);
+        }
+        else if (!strcmp(argv[i], "--fast-forward") && i + 1 < argc)
+        {
+            fast_forward_steps = SDL_max(atoi(argv[++i]), 0);
+        }
+        else if (!strcmp(argv[i], "--max-fps") && i + 1 < argc)
+        {
+            max_fps = SDL_max(atoi(argv[++i]), 0);
+        }
+        else if (!strcmp(argv[i], "--background-fps") && i + 1 < argc)
+        {
+            background_fps = SDL_max(atoi(argv[++i]), 0);
+        }
+        else if (!strcmp(argv[i], "--present") && i + 1 < argc)
+        {
+            if (!parse_present_mode(argv[++i], &present_mode))
+            {
+                SDL_Log("Unknown present mode: %s", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--frames-in-flight") && i + 1 < argc)
+        {
+            frames_in_flight = SDL_clamp(atoi(argv[++i]), 1, MAX_FRAMES_IN_FLIGHT);
+        }
+        else if (!strcmp(argv[i], "--latency") && i + 1 < argc)
+        {
+            latency_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--sort") && i + 1 < argc)
+        {
+            sort_interval = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--tune"))
+        {
+            retune = true;
+        }
+        else if (!strcmp(argv[i], "--headless") && i + 1 < argc)
+        {
+            headless_steps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+        {
+            output_interval = atoi(argv[++i]);
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (headless_steps > 0)
+    {
+        return run_headless(path, retune) ? 0 : 1;
+    }
     if (!SDL_Init(SDL_INIT_VIDEO))
     {
         SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
@@ -229,91 +1405,122 @@ int main(int argc, char** argv)
         SDL_Log("Failed to create swapchain: %s", SDL_GetError());
         return 1;
     }
-    SDL_GPUShader* draw_shader = load_shader(device, "draw.frag");
-    SDL_GPUShader* quad_shader = load_shader(device, "quad.vert");
-    blur_pipeline = load_compute_pipeline(device, "blur.comp");
-    update_pipeline = load_compute_pipeline(device, "update.comp");
-    if (!draw_shader || !quad_shader || !blur_pipeline || !update_pipeline)
+    if (!SDL_WindowSupportsGPUPresentMode(device, window, present_mode))
     {
-        SDL_Log("Failed to load shader(s)");
-        return false;
+        SDL_Log("Present mode not supported, using vsync");
+        present_mode = SDL_GPU_PRESENTMODE_VSYNC;
     }
-    draw_pipeline = SDL_CreateGPUGraphicsPipeline(device,
-        &(SDL_GPUGraphicsPipelineCreateInfo)
+    if (!SDL_SetGPUSwapchainParameters(device, window, SDL_GPU_SWAPCHAINCOMPOSITION_SDR, present_mode))
     {
-        .vertex_shader = quad_shader,
-        .fragment_shader = draw_shader,
-        .target_info =
+        SDL_Log("Failed to set swapchain parameters: %s", SDL_GetError());
+    }
+    if (!SDL_SetGPUAllowedFramesInFlight(device, frames_in_flight))
+    {
+        SDL_Log("Failed to set frames in flight: %s", SDL_GetError());
+    }
+    if (latency_path)
+    {
+        if (!(latency_stream = SDL_IOFromFile(latency_path, "w")))
         {
-            .num_color_targets = 1,
-            .color_target_descriptions = &(SDL_GPUColorTargetDescription)
-            {
-                .format = SDL_GetGPUSwapchainTextureFormat(device, window),
-                .blend_state =
-                {
-                    .src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
-                    .dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                    .color_blend_op = SDL_GPU_BLENDOP_ADD,
-                    .src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
-                    .dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                    .alpha_blend_op = SDL_GPU_BLENDOP_ADD,
-                    .enable_blend = true,
-                }
-            },
-        },
-    });
-    if (!draw_pipeline)
+            SDL_Log("Failed to open %s: %s", latency_path, SDL_GetError());
+            return 1;
+        }
+        SDL_IOprintf(latency_stream, "frame,submit_to_complete_ms\n");
+    }
+    latency_mutex = SDL_CreateMutex();
+    latency_condition = SDL_CreateCondition();
+    if (!latency_mutex || !latency_condition)
+    {
+        SDL_Log("Failed to create mutex: %s", SDL_GetError());
+        return 1;
+    }
+    if (!(latency_thread = SDL_CreateThread(watch, "latency", NULL)))
+    {
+        SDL_Log("Failed to create thread: %s", SDL_GetError());
+        return 1;
+    }
+    if (!sim_init(device, SDL_GetGPUSwapchainTextureFormat(device, window)))
+    {
+        SDL_Log("Failed to initialize simulation");
+        return 1;
+    }
+    if (!sim_tune(retune))
+    {
+        SDL_Log("Using default workgroup sizes");
+    }
+    wake_event = SDL_RegisterEvents(1);
+    if (!wake_event)
+    {
+        SDL_Log("Failed to register event: %s", SDL_GetError());
+        return 1;
+    }
+    sim_mutex = SDL_CreateMutex();
+    sim_condition = SDL_CreateCondition();
+    if (!sim_mutex || !sim_condition)
+    {
+        SDL_Log("Failed to create mutex: %s", SDL_GetError());
+        return 1;
+    }
+    /* The slot starts out holding a snapshot that is not fresh, the other two belong to each thread */
+    snapshot_back = 0;
+    SDL_SetAtomicInt(&snapshot_slot, 1);
+    snapshot_front = 2;
+    profile_start = SDL_GetPerformanceCounter();
+    if (!(sim_thread = SDL_CreateThread(run, "sim", NULL)))
     {
-        SDL_Log("Failed to create draw pipeline: %s", SDL_GetError());
+        SDL_Log("Failed to create thread: %s", SDL_GetError());
         return 1;
     }
-    SDL_ReleaseGPUShader(device, draw_shader);
-    SDL_ReleaseGPUShader(device, quad_shader);
-    SDL_GPUSamplerCreateInfo sci = {0};
-    sci.min_filter = SDL_GPU_FILTER_NEAREST;
-    sci.mag_filter = SDL_GPU_FILTER_NEAREST;
-    sci.mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_NEAREST;
-    sci.address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-    sci.address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-    sci.address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
-    sampler = SDL_CreateGPUSampler(device, &sci);
-    if (!sampler)
-    {
-        SDL_Log("Failed to create sampler: %s", SDL_GetError());
+    if (video_path && !start_video())
+    {
+        SDL_Log("Failed to start video");
         return 1;
     }
-    if (argc >= 2 && !reload(argv[1]))
+    if (!video_path && path && !reload(path, sim_mutex))
     {
         SDL_Log("Failed to load image");
         return 1;
     }
     bool running = true;
-    uint64_t t1 = SDL_GetPerformanceCounter();
-    uint64_t t2 = 0;
     while (running)
     {
-        t2 = t1;
-        t1 = SDL_GetPerformanceCounter();
-        const float frequency = SDL_GetPerformanceFrequency();
-        const float dt = (t1 - t2) / frequency;
+        /* Raised before checking for a snapshot so one published meanwhile still wakes the loop */
         SDL_Event event;
+        SDL_SetAtomicInt(&render_waiting, 1);
+        const Sint32 timeout = get_timeout();
+        if (timeout < 0 && SDL_WaitEvent(&event))
+        {
+            running &= handle_event(&event);
+        }
+        else if (timeout > 0 && SDL_WaitEventTimeout(&event, timeout))
+        {
+            running &= handle_event(&event);
+        }
+        SDL_SetAtomicInt(&render_waiting, 0);
         while (SDL_PollEvent(&event))
         {
-            switch (event.type)
-            {
-            case SDL_EVENT_QUIT:
-                running = false;
-                break;
-            case SDL_EVENT_DROP_FILE:
-                reload(event.drop.data);
-                break;
-            }
+            running &= handle_event(&event);
+        }
+        poll_ingest();
+        poll_video();
+        /* Whichever snapshot the simulation finished last is taken and the drawn one is handed back */
+        if (SDL_GetAtomicInt(&snapshot_slot) & SNAPSHOT_FRESH)
+        {
+            snapshot_front = SDL_SetAtomicInt(&snapshot_slot, snapshot_front) & ~SNAPSHOT_FRESH;
+            shown = true;
+            dirty = true;
+        }
+        if (!shown || !dirty || occluded || !running)
+        {
+            continue;
         }
-        if (!loaded)
+        const uint64_t time = SDL_GetTicksNS();
+        if (max_fps > 0 && time < frame_time)
         {
             continue;
         }
-        SDL_WaitForGPUSwapchain(device, window);
+        frame_time = time + SDL_NS_PER_SECOND / SDL_max(max_fps, 1);
+        dirty = false;
         SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
         if (!cb)
         {
@@ -324,110 +1531,74 @@ int main(int argc, char** argv)
         if (!SDL_WaitAndAcquireGPUSwapchainTexture(cb, window, &texture, NULL, NULL))
         {
             SDL_Log("Failed to acquire swapchain texture: %s", SDL_GetError());
-            SDL_CancelGPUCommandBuffer(cb);
+            SDL_SubmitGPUCommandBuffer(cb);
             continue;
         }
+        if (texture)
         {
-            SDL_PushGPUDebugGroup(cb, "blit");
-            SDL_GPUBlitInfo info = {0};
-            info.source.texture = trail_texture1;
-            info.source.w = WIDTH;
-            info.source.h = HEIGHT;
-            info.destination.texture = trail_texture2;
-            info.destination.w = WIDTH;
-            info.destination.h = HEIGHT;
-            for (int i = 0; i < COLOR_COUNT; i++)
-            {
-                info.source.layer_or_depth_plane = i;
-                info.destination.layer_or_depth_plane = i;
-                SDL_BlitGPUTexture(cb, &info);
-            }
-            SDL_PopGPUDebugGroup(cb);
+            sim_draw_snapshot(cb, &snapshots[snapshot_front], texture);
+            submit_frame(cb);
         }
+        else
         {
-            SDL_PushGPUDebugGroup(cb, "update");
-            SDL_GPUStorageBufferReadWriteBinding sbb = {0};
-            sbb.buffer = agent_buffer;
-            SDL_GPUStorageTextureReadWriteBinding stb = {0};
-            stb.texture = trail_texture2;
-            stb.cycle = true;
-            SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, &stb, 1, &sbb, 1);
-            if (!pass)
-            {
-                SDL_PopGPUDebugGroup(cb);
-                SDL_SubmitGPUCommandBuffer(cb);
-                SDL_Log("Failed to begin update pass: %s", SDL_GetError());
-                continue;
-            }
-            SDL_GPUTextureSamplerBinding tsb = {0};
-            tsb.sampler = sampler;
-            tsb.texture = trail_texture1;
-            SDL_BindGPUComputePipeline(pass, update_pipeline);
-            SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
-            const int x = (float) (WIDTH + THREADS_X - 1) / THREADS_X;
-            const int y = (float) (HEIGHT + THREADS_Y - 1) / THREADS_Y;
-            SDL_PushGPUComputeUniformData(cb, 0, &t2, sizeof(t2));
-            SDL_PushGPUComputeUniformData(cb, 1, &dt, sizeof(dt));
-            SDL_DispatchGPUCompute(pass, x, y, 1);
-            SDL_EndGPUComputePass(pass);
-            SDL_PopGPUDebugGroup(cb);
-        }
-        {
-            SDL_PushGPUDebugGroup(cb, "blur");
-            SDL_GPUStorageTextureReadWriteBinding stb = {0};
-            stb.texture = trail_texture1;
-            stb.cycle = true;
-            SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, &stb, 1, NULL, 0);
-            if (!pass)
-            {
-                SDL_PopGPUDebugGroup(cb);
-                SDL_SubmitGPUCommandBuffer(cb);
-                SDL_Log("Failed to begin blur pass: %s", SDL_GetError());
-                continue;
-            }
-            SDL_GPUTextureSamplerBinding tsb = {0};
-            tsb.sampler = sampler;
-            tsb.texture = trail_texture2;
-            SDL_BindGPUComputePipeline(pass, blur_pipeline);
-            SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
-            const int x = (float) (WIDTH + THREADS_X - 1) / THREADS_X;
-            const int y = (float) (HEIGHT + THREADS_Y - 1) / THREADS_Y;
-            SDL_DispatchGPUCompute(pass, x, y, 1);
-            SDL_EndGPUComputePass(pass);
-            SDL_PopGPUDebugGroup(cb);
-        }
-        {
-            SDL_PushGPUDebugGroup(cb, "draw");
-            SDL_GPUColorTargetInfo cti = {0};
-            cti.texture = texture;
-            cti.load_op = SDL_GPU_LOADOP_CLEAR;
-            cti.store_op = SDL_GPU_STOREOP_STORE;
-            SDL_GPURenderPass* pass = SDL_BeginGPURenderPass(cb, &cti, 1, NULL);
-            if (!pass)
-            {
-                SDL_PopGPUDebugGroup(cb);
-                SDL_SubmitGPUCommandBuffer(cb);
-                SDL_Log("Failed to begin draw pass: %s", SDL_GetError());
-                continue;
-            }
-            SDL_GPUTextureSamplerBinding binding = {0};
-            binding.texture = trail_texture1;
-            binding.sampler = sampler;
-            SDL_BindGPUGraphicsPipeline(pass, draw_pipeline);
-            SDL_BindGPUFragmentSamplers(pass, 0, &binding, 1);
-            SDL_DrawGPUPrimitives(pass, 4, 1, 0, 0);
-            SDL_EndGPURenderPass(pass);
-            SDL_PopGPUDebugGroup(cb);
+            SDL_SubmitGPUCommandBuffer(cb);
         }
-        SDL_SubmitGPUCommandBuffer(cb);
     }
-    SDL_ReleaseGPUBuffer(device, agent_buffer);
-    SDL_ReleaseGPUTexture(device, trail_texture1);
-    SDL_ReleaseGPUTexture(device, trail_texture2);
-    SDL_ReleaseGPUSampler(device, sampler);
-    SDL_ReleaseGPUGraphicsPipeline(device, draw_pipeline);
-    SDL_ReleaseGPUComputePipeline(device, blur_pipeline);
-    SDL_ReleaseGPUComputePipeline(device, update_pipeline);
+    SDL_LockMutex(sim_mutex);
+    sim_stop = true;
+    SDL_SignalCondition(sim_condition);
+    SDL_UnlockMutex(sim_mutex);
+    SDL_WaitThread(sim_thread, NULL);
+    SDL_LockMutex(latency_mutex);
+    latency_stop = true;
+    SDL_BroadcastCondition(latency_condition);
+    SDL_UnlockMutex(latency_mutex);
+    SDL_WaitThread(latency_thread, NULL);
+    SDL_DestroyCondition(latency_condition);
+    SDL_DestroyMutex(latency_mutex);
+    if (latency_samples > 0)
+    {
+        SDL_Log("Submit to completion: %f ms average, %f ms max over %" SDL_PRIu64 " frames",
+            latency_sum / 1000000.0 / latency_samples, latency_max / 1000000.0, latency_samples);
+    }
+    if (latency_stream)
+    {
+        SDL_CloseIO(latency_stream);
+    }
+    if (ingest_thread)
+    {
+        SDL_WaitThread(ingest_thread, NULL);
+        free(ingest_species);
+    }
+    SDL_free(ingest_path);
+    SDL_free(ingest_pending);
+    if (video_thread)
+    {
+        SDL_LockMutex(video_mutex);
+        SDL_SetAtomicInt(&video_quit, 1);
+        SDL_SignalCondition(video_condition);
+        SDL_UnlockMutex(video_mutex);
+        /* A stream on stdin can block forever so that thread is left to exit with the process */
+        if (strcmp(video_path, "-"))
+        {
+            SDL_WaitThread(video_thread, NULL);
+            SDL_DestroyCondition(video_condition);
+            SDL_DestroyMutex(video_mutex);
+        }
+        else
+        {
+            SDL_DetachThread(video_thread);
+        }
+    }
+    free(video_species);
+    for (int i = 0; i < SNAPSHOT_COUNT; i++)
+    {
+        sim_release_snapshot(&snapshots[i]);
+    }
+    SDL_DestroyCondition(sim_condition);
+    SDL_DestroyMutex(sim_mutex);
+    sim_destroy(&sim);
+    sim_quit();
     SDL_ReleaseWindowFromGPUDevice(device, window);
     SDL_DestroyGPUDevice(device);
     SDL_DestroyWindow(window);
@@ -0,0 +1,283 @@
+#include <SDL3/SDL.h>
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "palette.h"
+#include "util.h"
+
+#define SAMPLES 4096
+#define BATCH 256
+#define ITERATIONS 64
+#define MERGE_DISTANCE 24.0f
+
+/* Channels are kept in separate arrays so the distance loops vectorize */
+typedef struct
+{
+    float r[SAMPLES];
+    float g[SAMPLES];
+    float b[SAMPLES];
+    float distances[SAMPLES];
+    uint8_t labels[SAMPLES];
+}
+samples_t;
+
+static uint32_t next(uint32_t* state)
+{
+    /* xorshift32, seeded the same every time so an image always gets the same palette */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static float random_float(uint32_t* state)
+{
+    return (next(state) >> 8) / 16777216.0f;
+}
+
+static void assign(
+    samples_t* samples,
+    const float centers[COLOR_COUNT][3],
+    uint32_t count,
+    uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        samples->distances[i] = FLT_MAX;
+        samples->labels[i] = 0;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const float r = centers[i][0];
+        const float g = centers[i][1];
+        const float b = centers[i][2];
+        for (uint32_t j = 0; j < size; j++)
+        {
+            const float dr = samples->r[j] - r;
+            const float dg = samples->g[j] - g;
+            const float db = samples->b[j] - b;
+            const float distance = dr * dr + dg * dg + db * db;
+            const bool closer = distance < samples->distances[j];
+            samples->distances[j] = closer ? distance : samples->distances[j];
+            samples->labels[j] = closer ? i : samples->labels[j];
+        }
+    }
+}
+
+bool palette_cluster(
+    palette_t* palette,
+    const uint8_t* pixels,
+    uint32_t size,
+    uint32_t count)
+{
+    assert(palette);
+    assert(pixels);
+    assert(size > 0);
+    assert(count > 0 && count <= COLOR_COUNT);
+    memset(palette, 0, sizeof(palette_t));
+    samples_t* samples = malloc(sizeof(samples_t));
+    samples_t* batch = malloc(sizeof(samples_t));
+    if (!samples || !batch)
+    {
+        SDL_Log("Failed to allocate samples");
+        free(samples);
+        free(batch);
+        return false;
+    }
+    /* Cluster an evenly strided subsample, the full image adds time but not accuracy */
+    const uint32_t sample_count = SDL_min(size, SAMPLES);
+    for (uint32_t i = 0; i < sample_count; i++)
+    {
+        const uint8_t* pixel = &pixels[(uint64_t) i * size / sample_count * 3];
+        samples->r[i] = pixel[0];
+        samples->g[i] = pixel[1];
+        samples->b[i] = pixel[2];
+    }
+    /* k-means++ seeding, stopping early when every sample already sits on a center */
+    uint32_t state = 0x9E3779B9;
+    float centers[COLOR_COUNT][3];
+    uint32_t index = next(&state) % sample_count;
+    uint32_t centers_count = 0;
+    while (true)
+    {
+        centers[centers_count][0] = samples->r[index];
+        centers[centers_count][1] = samples->g[index];
+        centers[centers_count][2] = samples->b[index];
+        centers_count++;
+        if (centers_count == count)
+        {
+            break;
+        }
+        assign(samples, centers, centers_count, sample_count);
+        double total = 0.0;
+        for (uint32_t i = 0; i < sample_count; i++)
+        {
+            total += samples->distances[i];
+        }
+        if (total <= 0.0)
+        {
+            break;
+        }
+        double target = random_float(&state) * total;
+        index = sample_count - 1;
+        for (uint32_t i = 0; i < sample_count; i++)
+        {
+            target -= samples->distances[i];
+            if (target < 0.0)
+            {
+                index = i;
+                break;
+            }
+        }
+    }
+    /* Mini-batch k-means (Sculley 2010) with per-center learning rates */
+    uint32_t totals[COLOR_COUNT] = {0};
+    const uint32_t batch_size = SDL_min(sample_count, BATCH);
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        for (uint32_t j = 0; j < batch_size; j++)
+        {
+            const uint32_t k = next(&state) % sample_count;
+            batch->r[j] = samples->r[k];
+            batch->g[j] = samples->g[k];
+            batch->b[j] = samples->b[k];
+        }
+        assign(batch, centers, centers_count, batch_size);
+        for (uint32_t j = 0; j < batch_size; j++)
+        {
+            const uint8_t label = batch->labels[j];
+            const float rate = 1.0f / ++totals[label];
+            centers[label][0] += (batch->r[j] - centers[label][0]) * rate;
+            centers[label][1] += (batch->g[j] - centers[label][1]) * rate;
+            centers[label][2] += (batch->b[j] - centers[label][2]) * rate;
+        }
+    }
+    /* Empty centers and centers too close to a larger one are dropped so the species count shrinks */
+    uint32_t members[COLOR_COUNT] = {0};
+    assign(samples, centers, centers_count, sample_count);
+    for (uint32_t i = 0; i < sample_count; i++)
+    {
+        members[samples->labels[i]]++;
+    }
+    palette->count = 0;
+    while (true)
+    {
+        uint32_t largest = 0;
+        for (uint32_t i = 1; i < centers_count; i++)
+        {
+            if (members[i] > members[largest])
+            {
+                largest = i;
+            }
+        }
+        if (!members[largest])
+        {
+            break;
+        }
+        members[largest] = 0;
+        bool merged = false;
+        for (uint32_t i = 0; i < palette->count && !merged; i++)
+        {
+            const float dr = palette->colors[i][0] * 255.0f - centers[largest][0];
+            const float dg = palette->colors[i][1] * 255.0f - centers[largest][1];
+            const float db = palette->colors[i][2] * 255.0f - centers[largest][2];
+            merged = dr * dr + dg * dg + db * db < MERGE_DISTANCE * MERGE_DISTANCE;
+        }
+        if (merged)
+        {
+            continue;
+        }
+        float* color = palette->colors[palette->count++];
+        color[0] = centers[largest][0] / 255.0f;
+        color[1] = centers[largest][1] / 255.0f;
+        color[2] = centers[largest][2] / 255.0f;
+        color[3] = 1.0f;
+    }
+    free(samples);
+    free(batch);
+    return true;
+}
+
+static float to_linear(float value)
+{
+    if (value <= 0.04045f)
+    {
+        return value / 12.92f;
+    }
+    return SDL_powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float to_lab_axis(float value)
+{
+    if (value > 216.0f / 24389.0f)
+    {
+        return SDL_powf(value, 1.0f / 3.0f);
+    }
+    return (24389.0f / 27.0f * value + 16.0f) / 116.0f;
+}
+
+static void to_lab(
+    const float rgb[3],
+    float lab[3])
+{
+    /* sRGB to XYZ (D65) to CIELAB */
+    const float r = to_linear(rgb[0]);
+    const float g = to_linear(rgb[1]);
+    const float b = to_linear(rgb[2]);
+    const float x = to_lab_axis((0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f);
+    const float y = to_lab_axis((0.2126f * r + 0.7152f * g + 0.0722f * b) / 1.00000f);
+    const float z = to_lab_axis((0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f);
+    lab[0] = 116.0f * y - 16.0f;
+    lab[1] = 500.0f * (x - y);
+    lab[2] = 200.0f * (y - z);
+}
+
+void palette_create_lut(
+    const palette_t* palette,
+    bool perceptual,
+    uint8_t* lut)
+{
+    assert(palette);
+    assert(lut);
+    /* Perceptual matching measures distances in Lab, the lookups themselves cost the same */
+    float colors[COLOR_COUNT][3];
+    for (uint32_t i = 0; i < palette->count; i++)
+    {
+        if (perceptual)
+        {
+            to_lab(palette->colors[i], colors[i]);
+        }
+        else
+        {
+            memcpy(colors[i], palette->colors[i], sizeof(colors[i]));
+        }
+    }
+    for (int i = 0; i < 1 << 15; i++)
+    {
+        /* Classify the center of each bucket */
+        float color[3];
+        color[0] = (((i >> 0) & 0x1F) << 3 | 4) / 255.0f;
+        color[1] = (((i >> 5) & 0x1F) << 3 | 4) / 255.0f;
+        color[2] = (((i >> 10) & 0x1F) << 3 | 4) / 255.0f;
+        if (perceptual)
+        {
+            to_lab(color, color);
+        }
+        float distance1 = FLT_MAX;
+        for (uint32_t j = 0; j < palette->count; j++)
+        {
+            const float distance2 =
+                (color[0] - colors[j][0]) * (color[0] - colors[j][0]) +
+                (color[1] - colors[j][1]) * (color[1] - colors[j][1]) +
+                (color[2] - colors[j][2]) * (color[2] - colors[j][2]);
+            if (distance2 < distance1)
+            {
+                distance1 = distance2;
+                lut[i] = j;
+            }
+        }
+    }
+}
\ No newline at end of file
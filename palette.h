@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+/* Matches the std140 layout of the palette uniform in draw.frag */
+typedef struct
+{
+    float colors[COLOR_COUNT][4];
+    uint32_t count;
+}
+palette_t;
+
+bool palette_cluster(
+    palette_t* palette,
+    const uint8_t* pixels,
+    uint32_t size,
+    uint32_t count);
+void palette_create_lut(
+    const palette_t* palette,
+    bool perceptual,
+    uint8_t* lut);
\ No newline at end of file
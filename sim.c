@@ -0,0 +1,1741 @@
+#include <SDL3/SDL.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "sim.h"
+#include "util.h"
+
+static const struct
+{
+    const char* name;
+    const char* suffix;
+    SDL_GPUTextureFormat format;
+    uint32_t size;
+}
+formats[TRAIL_FORMAT_COUNT] =
+{
+    [TRAIL_FORMAT_F32] = {"f32", "", SDL_GPU_TEXTUREFORMAT_R32G32B32A32_FLOAT, 16},
+    [TRAIL_FORMAT_F16] = {"f16", "_f16", SDL_GPU_TEXTUREFORMAT_R16G16B16A16_FLOAT, 8},
+    [TRAIL_FORMAT_UNORM8] = {"unorm8", "_unorm8", SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM, 4},
+};
+
+/* Local sizes built for update.comp and blur.comp, see CMakeLists.txt */
+static const int update_sizes[] = {64, 128, 256, 512, 1024};
+static const struct
+{
+    int x;
+    int y;
+}
+blur_sizes[] = {{8, 8}, {16, 8}, {16, 16}, {32, 8}, {32, 32}};
+
+#define UPDATE_SIZE_COUNT SDL_arraysize(update_sizes)
+#define BLUR_SIZE_COUNT SDL_arraysize(blur_sizes)
+
+static SDL_GPUDevice* device;
+static SDL_GPUComputePipeline* update_pipelines[UPDATE_SIZE_COUNT];
+static SDL_GPUComputePipeline* update_direct_pipelines[UPDATE_SIZE_COUNT];
+static SDL_GPUComputePipeline* blur_pipelines[TRAIL_FORMAT_COUNT][BLUR_SIZE_COUNT];
+static int update_size;
+static int update_direct_size;
+static int blur_size[TRAIL_FORMAT_COUNT];
+static SDL_GPUGraphicsPipeline* deposit_pipelines[TRAIL_FORMAT_COUNT];
+static SDL_GPUComputePipeline* sat_rows_pipeline;
+static SDL_GPUComputePipeline* sat_cols_pipeline;
+static SDL_GPUComputePipeline* sort_clear_pipeline;
+static SDL_GPUComputePipeline* sort_count_pipeline;
+static SDL_GPUComputePipeline* sort_scan_pipeline;
+static SDL_GPUComputePipeline* sort_scatter_pipeline;
+static SDL_GPUComputePipeline* spawn_pipeline;
+static SDL_GPUComputePipeline* spawn_density_pipeline;
+static SDL_GPUComputePipeline* spawn_weights_pipeline;
+static SDL_GPUComputePipeline* reseed_scatter_pipeline;
+static SDL_GPUComputePipeline* reseed_agents_pipeline;
+static SDL_GPUGraphicsPipeline* draw_pipeline;
+static SDL_GPUSampler* sampler;
+static SDL_GPUTextureFormat draw_format;
+static SDL_GPUTransferBuffer* upload_buffers[UPLOAD_CHUNKS];
+static int upload_index;
+/* Released buffers and textures are kept and handed out again when they fit */
+static struct
+{
+    SDL_GPUBuffer* buffer;
+    SDL_GPUBufferCreateInfo info;
+    bool used;
+}
+buffer_pool[POOL_SIZE];
+static struct
+{
+    SDL_GPUTexture* texture;
+    SDL_GPUTextureCreateInfo info;
+    bool used;
+}
+texture_pool[POOL_SIZE];
+
+static SDL_GPUComputePipeline* load_update_pipeline(
+    const char* name,
+    int size)
+{
+    char file[64];
+    SDL_snprintf(file, sizeof(file), "%s_%d.comp", name, update_sizes[size]);
+    return load_compute_pipeline(device, file);
+}
+
+static SDL_GPUComputePipeline* load_blur_pipeline(
+    trail_format_t format,
+    int size)
+{
+    char file[64];
+    SDL_snprintf(file, sizeof(file), "blur%s_%dx%d.comp", formats[format].suffix,
+        blur_sizes[size].x, blur_sizes[size].y);
+    return load_compute_pipeline(device, file);
+}
+
+bool sim_init(
+    SDL_GPUDevice* handle,
+    SDL_GPUTextureFormat format)
+{
+    assert(handle);
+    device = handle;
+    draw_format = format;
+    /* Uploads stream through a fixed ring so host memory stays bounded whatever their size */
+    for (int i = 0; i < UPLOAD_CHUNKS; i++)
+    {
+        SDL_GPUTransferBufferCreateInfo tbci = {0};
+        tbci.size = UPLOAD_CHUNK_SIZE;
+        tbci.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
+        upload_buffers[i] = SDL_CreateGPUTransferBuffer(device, &tbci);
+        if (!upload_buffers[i])
+        {
+            SDL_Log("Failed to create transfer buffer: %s", SDL_GetError());
+            return false;
+        }
+    }
+    SDL_GPUShader* deposit_frag_shader = load_shader(device, "deposit.frag");
+    SDL_GPUShader* deposit_vert_shader = load_shader(device, "deposit.vert");
+    SDL_GPUShader* draw_shader = load_shader(device, "draw.frag");
+    SDL_GPUShader* quad_shader = load_shader(device, "quad.vert");
+    sat_rows_pipeline = load_compute_pipeline(device, "sat_rows.comp");
+    sat_cols_pipeline = load_compute_pipeline(device, "sat_cols.comp");
+    sort_clear_pipeline = load_compute_pipeline(device, "sort_clear.comp");
+    sort_count_pipeline = load_compute_pipeline(device, "sort_count.comp");
+    sort_scan_pipeline = load_compute_pipeline(device, "sort_scan.comp");
+    sort_scatter_pipeline = load_compute_pipeline(device, "sort_scatter.comp");
+    spawn_pipeline = load_compute_pipeline(device, "spawn.comp");
+    spawn_density_pipeline = load_compute_pipeline(device, "spawn_density.comp");
+    spawn_weights_pipeline = load_compute_pipeline(device, "spawn_weights.comp");
+    reseed_scatter_pipeline = load_compute_pipeline(device, "reseed_scatter.comp");
+    reseed_agents_pipeline = load_compute_pipeline(device, "reseed_agents.comp");
+    if (!deposit_frag_shader || !deposit_vert_shader || !draw_shader || !quad_shader ||
+        !sat_rows_pipeline || !sat_cols_pipeline ||
+        !sort_clear_pipeline || !sort_count_pipeline || !sort_scan_pipeline || !sort_scatter_pipeline ||
+        !spawn_pipeline || !spawn_density_pipeline || !spawn_weights_pipeline ||
+        !reseed_scatter_pipeline || !reseed_agents_pipeline)
+    {
+        SDL_Log("Failed to load shader(s)");
+        return false;
+    }
+    /* Until tuned, use the local sizes from config.h */
+    for (int i = 0; i < UPDATE_SIZE_COUNT; i++)
+    {
+        update_pipelines[i] = load_update_pipeline("update", i);
+        update_direct_pipelines[i] = load_update_pipeline("update_direct", i);
+        if (!update_pipelines[i] || !update_direct_pipelines[i])
+        {
+            SDL_Log("Failed to load shader(s)");
+            return false;
+        }
+        if (update_sizes[i] == AGENT_THREADS)
+        {
+            update_size = i;
+            update_direct_size = i;
+        }
+    }
+    for (int i = 0; i < TRAIL_FORMAT_COUNT; i++)
+    {
+        for (int j = 0; j < BLUR_SIZE_COUNT; j++)
+        {
+            blur_pipelines[i][j] = load_blur_pipeline(i, j);
+            if (!blur_pipelines[i][j])
+            {
+                SDL_Log("Failed to load shader(s)");
+                return false;
+            }
+            if (blur_sizes[j].x == THREADS_X && blur_sizes[j].y == THREADS_Y)
+            {
+                blur_size[i] = j;
+            }
+        }
+        SDL_GPUColorTargetDescription ctd[TRAIL_LAYERS] = {0};
+        for (int j = 0; j < TRAIL_LAYERS; j++)
+        {
+            ctd[j].format = formats[i].format;
+            ctd[j].blend_state.src_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            ctd[j].blend_state.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            ctd[j].blend_state.color_blend_op = SDL_GPU_BLENDOP_ADD;
+            ctd[j].blend_state.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            ctd[j].blend_state.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            ctd[j].blend_state.alpha_blend_op = SDL_GPU_BLENDOP_ADD;
+            ctd[j].blend_state.enable_blend = true;
+        }
+        SDL_GPUGraphicsPipelineCreateInfo gpci = {0};
+        gpci.vertex_shader = deposit_vert_shader;
+        gpci.fragment_shader = deposit_frag_shader;
+        gpci.primitive_type = SDL_GPU_PRIMITIVETYPE_POINTLIST;
+        gpci.target_info.num_color_targets = TRAIL_LAYERS;
+        gpci.target_info.color_target_descriptions = ctd;
+        deposit_pipelines[i] = SDL_CreateGPUGraphicsPipeline(device, &gpci);
+        if (!deposit_pipelines[i])
+        {
+            SDL_Log("Failed to create deposit pipeline: %s", SDL_GetError());
+            return false;
+        }
+    }
+    SDL_ReleaseGPUShader(device, deposit_frag_shader);
+    SDL_ReleaseGPUShader(device, deposit_vert_shader);
+    draw_pipeline = SDL_CreateGPUGraphicsPipeline(device,
+        &(SDL_GPUGraphicsPipelineCreateInfo)
+    {
+        .vertex_shader = quad_shader,
+        .fragment_shader = draw_shader,
+        .target_info =
+        {
+            .num_color_targets = 1,
+            .color_target_descriptions = &(SDL_GPUColorTargetDescription)
+            {
+                .format = format,
+                .blend_state =
+                {
+                    .src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
+                    .dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                    .color_blend_op = SDL_GPU_BLENDOP_ADD,
+                    .src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
+                    .dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                    .alpha_blend_op = SDL_GPU_BLENDOP_ADD,
+                    .enable_blend = true,
+                }
+            },
+        },
+    });
+    if (!draw_pipeline)
+    {
+        SDL_Log("Failed to create draw pipeline: %s", SDL_GetError());
+        return false;
+    }
+    SDL_ReleaseGPUShader(device, draw_shader);
+    SDL_ReleaseGPUShader(device, quad_shader);
+    SDL_GPUSamplerCreateInfo sci = {0};
+    sci.min_filter = SDL_GPU_FILTER_NEAREST;
+    sci.mag_filter = SDL_GPU_FILTER_NEAREST;
+    sci.mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_NEAREST;
+    sci.address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+    sci.address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+    sci.address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+    sampler = SDL_CreateGPUSampler(device, &sci);
+    if (!sampler)
+    {
+        SDL_Log("Failed to create sampler: %s", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+void sim_quit()
+{
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        SDL_ReleaseGPUBuffer(device, buffer_pool[i].buffer);
+        SDL_ReleaseGPUTexture(device, texture_pool[i].texture);
+    }
+    memset(buffer_pool, 0, sizeof(buffer_pool));
+    memset(texture_pool, 0, sizeof(texture_pool));
+    for (int i = 0; i < UPLOAD_CHUNKS; i++)
+    {
+        SDL_ReleaseGPUTransferBuffer(device, upload_buffers[i]);
+        upload_buffers[i] = NULL;
+    }
+    SDL_ReleaseGPUSampler(device, sampler);
+    SDL_ReleaseGPUGraphicsPipeline(device, draw_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, sat_rows_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, sat_cols_pipeline);
+    for (int i = 0; i < UPDATE_SIZE_COUNT; i++)
+    {
+        SDL_ReleaseGPUComputePipeline(device, update_pipelines[i]);
+        SDL_ReleaseGPUComputePipeline(device, update_direct_pipelines[i]);
+    }
+    SDL_ReleaseGPUComputePipeline(device, sort_clear_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, sort_count_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, sort_scan_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, sort_scatter_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, spawn_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, spawn_density_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, spawn_weights_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, reseed_scatter_pipeline);
+    SDL_ReleaseGPUComputePipeline(device, reseed_agents_pipeline);
+    for (int i = 0; i < TRAIL_FORMAT_COUNT; i++)
+    {
+        for (int j = 0; j < BLUR_SIZE_COUNT; j++)
+        {
+            SDL_ReleaseGPUComputePipeline(device, blur_pipelines[i][j]);
+        }
+        SDL_ReleaseGPUGraphicsPipeline(device, deposit_pipelines[i]);
+    }
+    device = NULL;
+}
+
+bool sim_parse_format(
+    const char* name,
+    trail_format_t* format)
+{
+    assert(name);
+    assert(format);
+    for (int i = 0; i < TRAIL_FORMAT_COUNT; i++)
+    {
+        if (!strcmp(name, formats[i].name))
+        {
+            *format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* sim_get_format_name(
+    trail_format_t format)
+{
+    return formats[format].name;
+}
+
+static SDL_GPUBuffer* acquire_buffer(
+    const SDL_GPUBufferCreateInfo* info)
+{
+    /* The smallest free buffer that fits, so small requests don't take large buffers */
+    int best = -1;
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (buffer_pool[i].buffer && !buffer_pool[i].used &&
+            buffer_pool[i].info.usage == info->usage &&
+            buffer_pool[i].info.size >= info->size &&
+            (best < 0 || buffer_pool[i].info.size < buffer_pool[best].info.size))
+        {
+            best = i;
+        }
+    }
+    if (best >= 0)
+    {
+        buffer_pool[best].used = true;
+        return buffer_pool[best].buffer;
+    }
+    /* Only growing allocates and the free buffers it outgrew go back to the driver */
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (buffer_pool[i].buffer && !buffer_pool[i].used &&
+            buffer_pool[i].info.usage == info->usage)
+        {
+            SDL_ReleaseGPUBuffer(device, buffer_pool[i].buffer);
+            buffer_pool[i].buffer = NULL;
+        }
+    }
+    SDL_GPUBuffer* buffer = SDL_CreateGPUBuffer(device, info);
+    if (!buffer)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (!buffer_pool[i].buffer)
+        {
+            buffer_pool[i].buffer = buffer;
+            buffer_pool[i].info = *info;
+            buffer_pool[i].used = true;
+            break;
+        }
+    }
+    return buffer;
+}
+
+static void release_buffer(
+    SDL_GPUBuffer* buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (buffer_pool[i].buffer == buffer)
+        {
+            buffer_pool[i].used = false;
+            return;
+        }
+    }
+    /* Didn't fit in the pool */
+    SDL_ReleaseGPUBuffer(device, buffer);
+}
+
+static SDL_GPUTexture* acquire_texture(
+    const SDL_GPUTextureCreateInfo* info)
+{
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (texture_pool[i].texture && !texture_pool[i].used &&
+            texture_pool[i].info.type == info->type &&
+            texture_pool[i].info.format == info->format &&
+            texture_pool[i].info.usage == info->usage &&
+            texture_pool[i].info.width == info->width &&
+            texture_pool[i].info.height == info->height &&
+            texture_pool[i].info.layer_count_or_depth == info->layer_count_or_depth &&
+            texture_pool[i].info.num_levels == info->num_levels)
+        {
+            texture_pool[i].used = true;
+            return texture_pool[i].texture;
+        }
+    }
+    SDL_GPUTexture* texture = SDL_CreateGPUTexture(device, info);
+    if (!texture)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (!texture_pool[i].texture)
+        {
+            texture_pool[i].texture = texture;
+            texture_pool[i].info = *info;
+            texture_pool[i].used = true;
+            break;
+        }
+    }
+    return texture;
+}
+
+static void release_texture(
+    SDL_GPUTexture* texture)
+{
+    if (!texture)
+    {
+        return;
+    }
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        if (texture_pool[i].texture == texture)
+        {
+            texture_pool[i].used = false;
+            return;
+        }
+    }
+    SDL_ReleaseGPUTexture(device, texture);
+}
+
+/* Writes size bytes of the upload starting at offset straight into mapped memory */
+typedef void (*fill_t)(
+    void* dst,
+    uint32_t offset,
+    uint32_t size,
+    void* userdata);
+
+static void* map_chunk(
+    SDL_GPUTransferBuffer** tbo)
+{
+    /* Mapping with cycling hands back fresh memory while the GPU still reads an earlier chunk */
+    *tbo = upload_buffers[upload_index];
+    upload_index = (upload_index + 1) % UPLOAD_CHUNKS;
+    void* dst = SDL_MapGPUTransferBuffer(device, *tbo, true);
+    if (!dst)
+    {
+        SDL_Log("Failed to map transfer buffer: %s", SDL_GetError());
+    }
+    return dst;
+}
+
+static bool upload_texture(
+    SDL_GPUCommandBuffer* cb,
+    SDL_GPUTexture* texture,
+    uint32_t width,
+    uint32_t height,
+    uint32_t pitch,
+    fill_t fill,
+    void* userdata)
+{
+    assert(pitch <= UPLOAD_CHUNK_SIZE);
+    SDL_GPUCopyPass* pass = SDL_BeginGPUCopyPass(cb);
+    if (!pass)
+    {
+        SDL_Log("Failed to begin copy pass: %s", SDL_GetError());
+        return false;
+    }
+    /* Chunks are whole rows so each one is a plain region upload */
+    const uint32_t chunk = UPLOAD_CHUNK_SIZE / pitch;
+    for (uint32_t y = 0; y < height; y += chunk)
+    {
+        const uint32_t rows = SDL_min(chunk, height - y);
+        SDL_GPUTransferBuffer* tbo;
+        void* dst = map_chunk(&tbo);
+        if (!dst)
+        {
+            SDL_EndGPUCopyPass(pass);
+            return false;
+        }
+        fill(dst, y * pitch, rows * pitch, userdata);
+        SDL_UnmapGPUTransferBuffer(device, tbo);
+        SDL_GPUTextureTransferInfo info = {0};
+        info.transfer_buffer = tbo;
+        SDL_GPUTextureRegion region = {0};
+        region.texture = texture;
+        region.y = y;
+        region.w = width;
+        region.h = rows;
+        region.d = 1;
+        SDL_UploadToGPUTexture(pass, &info, &region, false);
+    }
+    SDL_EndGPUCopyPass(pass);
+    return true;
+}
+
+static bool upload_buffer(
+    SDL_GPUCommandBuffer* cb,
+    SDL_GPUBuffer* buffer,
+    uint32_t size,
+    bool cycle,
+    fill_t fill,
+    void* userdata)
+{
+    SDL_GPUCopyPass* pass = SDL_BeginGPUCopyPass(cb);
+    if (!pass)
+    {
+        SDL_Log("Failed to begin copy pass: %s", SDL_GetError());
+        return false;
+    }
+    for (uint32_t offset = 0; offset < size; offset += UPLOAD_CHUNK_SIZE)
+    {
+        SDL_GPUTransferBuffer* tbo;
+        void* dst = map_chunk(&tbo);
+        if (!dst)
+        {
+            SDL_EndGPUCopyPass(pass);
+            return false;
+        }
+        const uint32_t chunk = SDL_min(UPLOAD_CHUNK_SIZE, size - offset);
+        fill(dst, offset, chunk, userdata);
+        SDL_UnmapGPUTransferBuffer(device, tbo);
+        SDL_GPUTransferBufferLocation location = {0};
+        location.transfer_buffer = tbo;
+        SDL_GPUBufferRegion region = {0};
+        region.buffer = buffer;
+        region.offset = offset;
+        region.size = chunk;
+        /* Only the first chunk may cycle or it would drop the ones before it */
+        SDL_UploadToGPUBuffer(pass, &location, &region, cycle && !offset);
+    }
+    SDL_EndGPUCopyPass(pass);
+    return true;
+}
+
+static void fill_copy(
+    void* dst,
+    uint32_t offset,
+    uint32_t size,
+    void* userdata)
+{
+    memcpy(dst, (const uint8_t*) userdata + offset, size);
+}
+
+static void fill_zero(
+    void* dst,
+    uint32_t offset,
+    uint32_t size,
+    void* userdata)
+{
+    memset(dst, 0, size);
+}
+
+static SDL_GPUBuffer* create_weights(
+    SDL_GPUCommandBuffer* cb,
+    SDL_GPUTexture* texture)
+{
+    SDL_GPUBufferCreateInfo bci = {0};
+    bci.size = SITES * sizeof(uint32_t);
+    bci.usage =
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ |
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE;
+    SDL_GPUBuffer* buffer = acquire_buffer(&bci);
+    if (!buffer)
+    {
+        SDL_Log("Failed to create buffer: %s", SDL_GetError());
+        return NULL;
+    }
+    /* The prefix sum of the site weights is scanned by a single workgroup */
+    SDL_GPUStorageBufferReadWriteBinding sbb = {0};
+    sbb.buffer = buffer;
+    SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, NULL, 0, &sbb, 1);
+    if (!pass)
+    {
+        SDL_Log("Failed to begin weights pass: %s", SDL_GetError());
+        release_buffer(buffer);
+        return NULL;
+    }
+    SDL_GPUTextureSamplerBinding tsb = {0};
+    tsb.sampler = sampler;
+    tsb.texture = texture;
+    SDL_BindGPUComputePipeline(pass, spawn_weights_pipeline);
+    SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
+    SDL_DispatchGPUCompute(pass, 1, 1, 1);
+    SDL_EndGPUComputePass(pass);
+    return buffer;
+}
+
+static bool spawn(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    const uint8_t* species,
+    bool density,
+    uint32_t seed)
+{
+    SDL_GPUTextureCreateInfo tci = {0};
+    tci.type = SDL_GPU_TEXTURETYPE_2D;
+    tci.format = SDL_GPU_TEXTUREFORMAT_R8_UINT;
+    tci.usage = SDL_GPU_TEXTUREUSAGE_SAMPLER;
+    tci.width = COLUMNS;
+    tci.height = ROWS;
+    tci.layer_count_or_depth = 1;
+    tci.num_levels = 1;
+    SDL_GPUTexture* texture = acquire_texture(&tci);
+    if (!texture)
+    {
+        SDL_Log("Failed to create texture: %s", SDL_GetError());
+        return false;
+    }
+    if (!upload_texture(cb, texture, COLUMNS, ROWS, COLUMNS, fill_copy, (void*) species))
+    {
+        release_texture(texture);
+        return false;
+    }
+    /* Density spawning samples sites from the prefix sum of their weights */
+    SDL_GPUBuffer* weights = NULL;
+    if (density && !(weights = create_weights(cb, texture)))
+    {
+        release_texture(texture);
+        return false;
+    }
+    SDL_PushGPUDebugGroup(cb, "spawn");
+    SDL_GPUStorageBufferReadWriteBinding sbb = {0};
+    sbb.buffer = sim->agent_buffer;
+    SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, NULL, 0, &sbb, 1);
+    if (!pass)
+    {
+        SDL_PopGPUDebugGroup(cb);
+        SDL_Log("Failed to begin spawn pass: %s", SDL_GetError());
+        release_texture(texture);
+        release_buffer(weights);
+        return false;
+    }
+    SDL_GPUTextureSamplerBinding tsb = {0};
+    tsb.sampler = sampler;
+    tsb.texture = texture;
+    SDL_BindGPUComputePipeline(pass, density ? spawn_density_pipeline : spawn_pipeline);
+    SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
+    if (density)
+    {
+        SDL_BindGPUComputeStorageBuffers(pass, 0, &weights, 1);
+    }
+    SDL_PushGPUComputeUniformData(cb, 0, &seed, sizeof(seed));
+    SDL_PushGPUComputeUniformData(cb, 1, &sim->agent_count, sizeof(sim->agent_count));
+    SDL_DispatchGPUCompute(pass, (sim->agent_count + AGENT_THREADS - 1) / AGENT_THREADS, 1, 1);
+    SDL_EndGPUComputePass(pass);
+    SDL_PopGPUDebugGroup(cb);
+    /* Back to the pool, later uses are recorded after this command buffer so they are ordered */
+    release_texture(texture);
+    release_buffer(weights);
+    return true;
+}
+
+bool sim_create(
+    sim_t* sim,
+    trail_format_t format,
+    const uint8_t* species,
+    const palette_t* palette,
+    uint32_t agent_count,
+    uint32_t seed)
+{
+    assert(sim);
+    assert(species);
+    assert(palette);
+    memset(sim, 0, sizeof(*sim));
+    sim->format = format;
+    sim->palette = *palette;
+    /* Without a budget every site gets one agent */
+    sim->agent_count = agent_count ? agent_count : SITES;
+    if (sim->agent_count > MAX_AGENTS)
+    {
+        SDL_Log("Too many agents: %u", sim->agent_count);
+        return false;
+    }
+    /* Kept so later frames of a video only upload the sites that changed */
+    sim->species = malloc(SITES);
+    if (!sim->species)
+    {
+        SDL_Log("Failed to allocate species");
+        return false;
+    }
+    memcpy(sim->species, species, SITES);
+    SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+    if (!cb)
+    {
+        SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+        return false;
+    }
+    SDL_GPUBufferCreateInfo bci = {0};
+    bci.size = sim->agent_count * sizeof(agent_t);
+    bci.usage =
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ |
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE |
+        SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ;
+    sim->agent_buffer = acquire_buffer(&bci);
+    sim->sorted_buffer = acquire_buffer(&bci);
+    bci.size = SORT_BINS * sizeof(uint32_t);
+    sim->histogram_buffer = acquire_buffer(&bci);
+    sim->offset_buffer = acquire_buffer(&bci);
+    if (!sim->agent_buffer || !sim->sorted_buffer || !sim->histogram_buffer || !sim->offset_buffer)
+    {
+        SDL_Log("Failed to create buffer(s): %s", SDL_GetError());
+        SDL_CancelGPUCommandBuffer(cb);
+        return false;
+    }
+    /* Only the species of each site are uploaded and the agents are created on the GPU */
+    if (!spawn(cb, sim, species, agent_count > 0, seed))
+    {
+        SDL_SubmitGPUCommandBuffer(cb);
+        return false;
+    }
+    SDL_GPUTextureCreateInfo tci = {0};
+    /* Species are interleaved four to a texel so one fetch serves several */
+    tci.type = SDL_GPU_TEXTURETYPE_2D_ARRAY;
+    tci.format = formats[format].format;
+    tci.usage =
+        SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_WRITE |
+        SDL_GPU_TEXTUREUSAGE_SAMPLER |
+        SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+    tci.width = WIDTH;
+    tci.height = HEIGHT;
+    tci.layer_count_or_depth = TRAIL_LAYERS;
+    tci.num_levels = 1;
+    if (!SDL_GPUTextureSupportsFormat(device, tci.format, tci.type, tci.usage))
+    {
+        SDL_Log("Unsupported trail format: %s", formats[format].name);
+        SDL_SubmitGPUCommandBuffer(cb);
+        return false;
+    }
+    sim->trail_texture1 = acquire_texture(&tci);
+    sim->trail_texture2 = acquire_texture(&tci);
+    if (!sim->trail_texture1 || !sim->trail_texture2)
+    {
+        SDL_Log("Failed to create texture(s): %s", SDL_GetError());
+        SDL_SubmitGPUCommandBuffer(cb);
+        return false;
+    }
+    tci.format = SDL_GPU_TEXTUREFORMAT_R32_UINT;
+    tci.usage =
+        SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_WRITE |
+        SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_SIMULTANEOUS_READ_WRITE |
+        SDL_GPU_TEXTUREUSAGE_SAMPLER;
+    tci.layer_count_or_depth = SAT_LAYERS;
+    sim->sat_texture = acquire_texture(&tci);
+    if (!sim->sat_texture)
+    {
+        SDL_Log("Failed to create texture: %s", SDL_GetError());
+        SDL_SubmitGPUCommandBuffer(cb);
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        SDL_GPUColorTargetInfo cti[TRAIL_LAYERS] = {0};
+        for (int j = 0; j < TRAIL_LAYERS; j++)
+        {
+            cti[j].texture = i ? sim->trail_texture2 : sim->trail_texture1;
+            cti[j].layer_or_depth_plane = j;
+            cti[j].load_op = SDL_GPU_LOADOP_CLEAR;
+            cti[j].store_op = SDL_GPU_STOREOP_STORE;
+        }
+        SDL_GPURenderPass* pass = SDL_BeginGPURenderPass(cb, cti, TRAIL_LAYERS, NULL);
+        if (!pass)
+        {
+            SDL_Log("Failed to begin render pass: %s", SDL_GetError());
+            SDL_SubmitGPUCommandBuffer(cb);
+            return false;
+        }
+        SDL_EndGPURenderPass(pass);
+    }
+    SDL_SubmitGPUCommandBuffer(cb);
+    return true;
+}
+
+void sim_destroy(
+    sim_t* sim)
+{
+    assert(sim);
+    release_buffer(sim->agent_buffer);
+    release_buffer(sim->sorted_buffer);
+    release_buffer(sim->histogram_buffer);
+    release_buffer(sim->offset_buffer);
+    /* A published trail belongs to its snapshot */
+    if (!sim->published)
+    {
+        release_texture(sim->trail_texture1);
+    }
+    release_texture(sim->trail_texture2);
+    release_texture(sim->spare_texture);
+    release_texture(sim->sat_texture);
+    release_buffer(sim->site_buffer);
+    release_buffer(sim->change_buffer);
+    free(sim->species);
+    memset(sim, 0, sizeof(*sim));
+}
+
+typedef struct
+{
+    const uint8_t* species;
+    uint8_t* previous;
+    uint32_t site;
+}
+changes_t;
+
+static void fill_changes(
+    void* dst,
+    uint32_t offset,
+    uint32_t size,
+    void* userdata)
+{
+    /* Changed sites are packed as the site above the species and the copy is updated as they go */
+    changes_t* changes = userdata;
+    uint32_t* packed = dst;
+    for (uint32_t i = 0; i < size / sizeof(uint32_t); changes->site++)
+    {
+        const uint32_t site = changes->site;
+        if (changes->species[site] != changes->previous[site])
+        {
+            packed[i++] = site << 8 | changes->species[site];
+            changes->previous[site] = changes->species[site];
+        }
+    }
+}
+
+static bool create_reseed_buffers(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim)
+{
+    /* Created on the first reseed since only videos need them */
+    SDL_GPUBufferCreateInfo bci = {0};
+    bci.size = SITES * sizeof(uint32_t);
+    bci.usage =
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ |
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE;
+    sim->site_buffer = acquire_buffer(&bci);
+    bci.usage = SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ;
+    sim->change_buffer = acquire_buffer(&bci);
+    if (!sim->site_buffer || !sim->change_buffer)
+    {
+        SDL_Log("Failed to create buffer(s): %s", SDL_GetError());
+        return false;
+    }
+    return upload_buffer(cb, sim->site_buffer, SITES * sizeof(uint32_t), false, fill_zero, NULL);
+}
+
+bool sim_reseed(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    const uint8_t* species)
+{
+    assert(cb);
+    assert(sim);
+    assert(species);
+    if (!sim->site_buffer && !create_reseed_buffers(cb, sim))
+    {
+        return false;
+    }
+    /* Only the changed sites are uploaded */
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < SITES; i++)
+    {
+        count += species[i] != sim->species[i];
+    }
+    if (!count)
+    {
+        return true;
+    }
+    SDL_PushGPUDebugGroup(cb, "reseed");
+    changes_t changes = {species, sim->species, 0};
+    if (!upload_buffer(cb, sim->change_buffer, count * sizeof(uint32_t), true, fill_changes, &changes))
+    {
+        SDL_PopGPUDebugGroup(cb);
+        return false;
+    }
+    sim->reseed_frame = (sim->reseed_frame + 1) & 0xFFFFFF;
+    sim->reseed_frame += !sim->reseed_frame;
+    const struct
+    {
+        SDL_GPUComputePipeline* pipeline;
+        SDL_GPUBuffer* input;
+        SDL_GPUBuffer* output;
+        uint32_t count;
+    }
+    stages[] =
+    {
+        {reseed_scatter_pipeline, sim->change_buffer, sim->site_buffer, count},
+        {reseed_agents_pipeline, sim->site_buffer, sim->agent_buffer, sim->agent_count},
+    };
+    for (int i = 0; i < SDL_arraysize(stages); i++)
+    {
+        SDL_GPUStorageBufferReadWriteBinding sbb = {0};
+        sbb.buffer = stages[i].output;
+        SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, NULL, 0, &sbb, 1);
+        if (!pass)
+        {
+            SDL_PopGPUDebugGroup(cb);
+            SDL_Log("Failed to begin reseed pass: %s", SDL_GetError());
+            return false;
+        }
+        SDL_BindGPUComputePipeline(pass, stages[i].pipeline);
+        SDL_BindGPUComputeStorageBuffers(pass, 0, &stages[i].input, 1);
+        SDL_PushGPUComputeUniformData(cb, 0, &sim->reseed_frame, sizeof(sim->reseed_frame));
+        SDL_PushGPUComputeUniformData(cb, 1, &stages[i].count, sizeof(stages[i].count));
+        SDL_DispatchGPUCompute(pass, (stages[i].count + AGENT_THREADS - 1) / AGENT_THREADS, 1, 1);
+        SDL_EndGPUComputePass(pass);
+    }
+    SDL_PopGPUDebugGroup(cb);
+    return true;
+}
+
+static bool sat(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim)
+{
+    SDL_PushGPUDebugGroup(cb, "sat");
+    {
+        SDL_GPUStorageTextureReadWriteBinding stb = {0};
+        stb.texture = sim->sat_texture;
+        stb.cycle = true;
+        SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, &stb, 1, NULL, 0);
+        if (!pass)
+        {
+            SDL_PopGPUDebugGroup(cb);
+            SDL_Log("Failed to begin sat rows pass: %s", SDL_GetError());
+            return false;
+        }
+        SDL_GPUTextureSamplerBinding tsb = {0};
+        tsb.sampler = sampler;
+        tsb.texture = sim->trail_texture1;
+        SDL_BindGPUComputePipeline(pass, sat_rows_pipeline);
+        SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
+        SDL_PushGPUComputeUniformData(cb, 0, &sim->palette.count, sizeof(sim->palette.count));
+        SDL_DispatchGPUCompute(pass, 1, HEIGHT, sim->palette.count + 1);
+        SDL_EndGPUComputePass(pass);
+    }
+    {
+        SDL_GPUStorageTextureReadWriteBinding stb = {0};
+        stb.texture = sim->sat_texture;
+        SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, &stb, 1, NULL, 0);
+        if (!pass)
+        {
+            SDL_PopGPUDebugGroup(cb);
+            SDL_Log("Failed to begin sat cols pass: %s", SDL_GetError());
+            return false;
+        }
+        const int x = (WIDTH + SAT_THREADS - 1) / SAT_THREADS;
+        SDL_BindGPUComputePipeline(pass, sat_cols_pipeline);
+        SDL_PushGPUComputeUniformData(cb, 0, &sim->palette.count, sizeof(sim->palette.count));
+        SDL_DispatchGPUCompute(pass, x, 1, sim->palette.count + 1);
+        SDL_EndGPUComputePass(pass);
+    }
+    SDL_PopGPUDebugGroup(cb);
+    return true;
+}
+
+static bool update(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    bool direct,
+    uint64_t time,
+    float dt)
+{
+    SDL_PushGPUDebugGroup(cb, "update");
+    SDL_GPUStorageBufferReadWriteBinding sbb = {0};
+    sbb.buffer = sim->agent_buffer;
+    SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, NULL, 0, &sbb, 1);
+    if (!pass)
+    {
+        SDL_PopGPUDebugGroup(cb);
+        SDL_Log("Failed to begin update pass: %s", SDL_GetError());
+        return false;
+    }
+    SDL_GPUTextureSamplerBinding tsb = {0};
+    tsb.sampler = sampler;
+    int threads;
+    if (direct)
+    {
+        tsb.texture = sim->trail_texture1;
+        threads = update_sizes[update_direct_size];
+        SDL_BindGPUComputePipeline(pass, update_direct_pipelines[update_direct_size]);
+    }
+    else
+    {
+        tsb.texture = sim->sat_texture;
+        threads = update_sizes[update_size];
+        SDL_BindGPUComputePipeline(pass, update_pipelines[update_size]);
+    }
+    SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
+    const int x = (sim->agent_count + threads - 1) / threads;
+    SDL_PushGPUComputeUniformData(cb, 0, &time, sizeof(time));
+    SDL_PushGPUComputeUniformData(cb, 1, &dt, sizeof(dt));
+    SDL_PushGPUComputeUniformData(cb, 2, &sim->agent_count, sizeof(sim->agent_count));
+    SDL_DispatchGPUCompute(pass, x, 1, 1);
+    SDL_EndGPUComputePass(pass);
+    SDL_PopGPUDebugGroup(cb);
+    return true;
+}
+
+bool sim_sense(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    bool direct,
+    uint64_t time,
+    float dt)
+{
+    assert(cb);
+    assert(sim);
+    if (!direct && !sat(cb, sim))
+    {
+        return false;
+    }
+    return update(cb, sim, direct, time, dt);
+}
+
+bool sim_sort(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim)
+{
+    assert(cb);
+    assert(sim);
+    SDL_PushGPUDebugGroup(cb, "sort");
+    const int agent_groups = (sim->agent_count + AGENT_THREADS - 1) / AGENT_THREADS;
+    const struct
+    {
+        SDL_GPUComputePipeline* pipeline;
+        SDL_GPUBuffer* buffers[3];
+        int groups;
+        bool agents;
+    }
+    stages[] =
+    {
+        {sort_clear_pipeline, {sim->histogram_buffer}, SORT_BINS / SORT_THREADS, false},
+        {sort_count_pipeline, {sim->agent_buffer, sim->histogram_buffer}, agent_groups, true},
+        {sort_scan_pipeline, {sim->histogram_buffer, sim->offset_buffer}, 1, false},
+        {sort_scatter_pipeline, {sim->agent_buffer, sim->sorted_buffer, sim->offset_buffer}, agent_groups, true},
+    };
+    /* Each stage gets its own pass since dispatches in a pass aren't synchronized */
+    for (int i = 0; i < SDL_arraysize(stages); i++)
+    {
+        SDL_GPUStorageBufferReadWriteBinding sbb[3] = {0};
+        int count = 0;
+        for (; count < 3 && stages[i].buffers[count]; count++)
+        {
+            sbb[count].buffer = stages[i].buffers[count];
+        }
+        SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, NULL, 0, sbb, count);
+        if (!pass)
+        {
+            SDL_PopGPUDebugGroup(cb);
+            SDL_Log("Failed to begin sort pass: %s", SDL_GetError());
+            return false;
+        }
+        SDL_BindGPUComputePipeline(pass, stages[i].pipeline);
+        if (stages[i].agents)
+        {
+            SDL_PushGPUComputeUniformData(cb, 0, &sim->agent_count, sizeof(sim->agent_count));
+        }
+        SDL_DispatchGPUCompute(pass, stages[i].groups, 1, 1);
+        SDL_EndGPUComputePass(pass);
+    }
+    SDL_PopGPUDebugGroup(cb);
+    SDL_GPUBuffer* buffer = sim->agent_buffer;
+    sim->agent_buffer = sim->sorted_buffer;
+    sim->sorted_buffer = buffer;
+    return true;
+}
+
+bool sim_blur(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim)
+{
+    assert(cb);
+    assert(sim);
+    SDL_PushGPUDebugGroup(cb, "blur");
+    SDL_GPUStorageTextureReadWriteBinding stb = {0};
+    stb.texture = sim->trail_texture2;
+    stb.cycle = true;
+    SDL_GPUComputePass* pass = SDL_BeginGPUComputePass(cb, &stb, 1, NULL, 0);
+    if (!pass)
+    {
+        SDL_PopGPUDebugGroup(cb);
+        SDL_Log("Failed to begin blur pass: %s", SDL_GetError());
+        return false;
+    }
+    SDL_GPUTextureSamplerBinding tsb = {0};
+    tsb.sampler = sampler;
+    tsb.texture = sim->trail_texture1;
+    const int size = blur_size[sim->format];
+    SDL_BindGPUComputePipeline(pass, blur_pipelines[sim->format][size]);
+    SDL_BindGPUComputeSamplers(pass, 0, &tsb, 1);
+    const int x = (WIDTH + blur_sizes[size].x - 1) / blur_sizes[size].x;
+    const int y = (HEIGHT + blur_sizes[size].y - 1) / blur_sizes[size].y;
+    SDL_DispatchGPUCompute(pass, x, y, 1);
+    SDL_EndGPUComputePass(pass);
+    SDL_PopGPUDebugGroup(cb);
+    SDL_PushGPUDebugGroup(cb, "deposit");
+    {
+        /* Agents are drawn as points and blended additively into the blurred trail */
+        SDL_GPUColorTargetInfo cti[TRAIL_LAYERS] = {0};
+        for (int i = 0; i < TRAIL_LAYERS; i++)
+        {
+            cti[i].texture = sim->trail_texture2;
+            cti[i].layer_or_depth_plane = i;
+            cti[i].load_op = SDL_GPU_LOADOP_LOAD;
+            cti[i].store_op = SDL_GPU_STOREOP_STORE;
+        }
+        SDL_GPURenderPass* render_pass = SDL_BeginGPURenderPass(cb, cti, TRAIL_LAYERS, NULL);
+        if (!render_pass)
+        {
+            SDL_PopGPUDebugGroup(cb);
+            SDL_Log("Failed to begin deposit pass: %s", SDL_GetError());
+            return false;
+        }
+        SDL_BindGPUGraphicsPipeline(render_pass, deposit_pipelines[sim->format]);
+        SDL_BindGPUVertexStorageBuffers(render_pass, 0, &sim->agent_buffer, 1);
+        SDL_DrawGPUPrimitives(render_pass, sim->agent_count, 1, 0, 0);
+        SDL_EndGPURenderPass(render_pass);
+    }
+    SDL_PopGPUDebugGroup(cb);
+    /* A published trail is only read again, the next blur writes the texture handed back */
+    SDL_GPUTexture* texture = sim->trail_texture1;
+    sim->trail_texture1 = sim->trail_texture2;
+    sim->trail_texture2 = texture;
+    if (sim->published)
+    {
+        sim->trail_texture2 = sim->spare_texture;
+        sim->spare_texture = NULL;
+        sim->published = false;
+    }
+    if (!sim->trail_texture2)
+    {
+        SDL_GPUTextureCreateInfo tci = {0};
+        tci.type = SDL_GPU_TEXTURETYPE_2D_ARRAY;
+        tci.format = formats[sim->format].format;
+        tci.usage =
+            SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_WRITE |
+            SDL_GPU_TEXTUREUSAGE_SAMPLER |
+            SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+        tci.width = WIDTH;
+        tci.height = HEIGHT;
+        tci.layer_count_or_depth = TRAIL_LAYERS;
+        tci.num_levels = 1;
+        sim->trail_texture2 = acquire_texture(&tci);
+        if (!sim->trail_texture2)
+        {
+            SDL_Log("Failed to create texture: %s", SDL_GetError());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool draw(
+    SDL_GPUCommandBuffer* cb,
+    SDL_GPUTexture* trail_texture,
+    const palette_t* palette,
+    SDL_GPUTexture* texture)
+{
+    SDL_PushGPUDebugGroup(cb, "draw");
+    SDL_GPUColorTargetInfo cti = {0};
+    cti.texture = texture;
+    cti.load_op = SDL_GPU_LOADOP_CLEAR;
+    cti.store_op = SDL_GPU_STOREOP_STORE;
+    SDL_GPURenderPass* pass = SDL_BeginGPURenderPass(cb, &cti, 1, NULL);
+    if (!pass)
+    {
+        SDL_PopGPUDebugGroup(cb);
+        SDL_Log("Failed to begin draw pass: %s", SDL_GetError());
+        return false;
+    }
+    SDL_GPUTextureSamplerBinding binding = {0};
+    binding.texture = trail_texture;
+    binding.sampler = sampler;
+    SDL_BindGPUGraphicsPipeline(pass, draw_pipeline);
+    SDL_BindGPUFragmentSamplers(pass, 0, &binding, 1);
+    SDL_PushGPUFragmentUniformData(cb, 0, palette, sizeof(*palette));
+    SDL_DrawGPUPrimitives(pass, 4, 1, 0, 0);
+    SDL_EndGPURenderPass(pass);
+    SDL_PopGPUDebugGroup(cb);
+    return true;
+}
+
+bool sim_draw(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    SDL_GPUTexture* texture)
+{
+    assert(cb);
+    assert(sim);
+    assert(texture);
+    return draw(cb, sim->trail_texture1, &sim->palette, texture);
+}
+
+bool sim_publish(
+    sim_t* sim,
+    sim_snapshot_t* snapshot)
+{
+    assert(sim);
+    assert(snapshot);
+    /* Handed over without a copy, the next blur writes whatever the snapshot held */
+    if (sim->published)
+    {
+        return false;
+    }
+    sim->spare_texture = snapshot->trail_texture;
+    snapshot->trail_texture = sim->trail_texture1;
+    snapshot->palette = sim->palette;
+    sim->published = true;
+    return true;
+}
+
+void sim_release_snapshot(
+    sim_snapshot_t* snapshot)
+{
+    assert(snapshot);
+    release_texture(snapshot->trail_texture);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+bool sim_draw_snapshot(
+    SDL_GPUCommandBuffer* cb,
+    const sim_snapshot_t* snapshot,
+    SDL_GPUTexture* texture)
+{
+    assert(cb);
+    assert(snapshot);
+    assert(texture);
+    return draw(cb, snapshot->trail_texture, &snapshot->palette, texture);
+}
+
+bool sim_save(
+    sim_t* sim,
+    const char* path)
+{
+    assert(sim);
+    assert(path);
+    SDL_PixelFormat pixel_format;
+    switch (draw_format)
+    {
+    case SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM:
+        pixel_format = SDL_PIXELFORMAT_RGBA32;
+        break;
+    case SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM:
+        pixel_format = SDL_PIXELFORMAT_BGRA32;
+        break;
+    default:
+        SDL_Log("Unsupported draw format: %d", draw_format);
+        return false;
+    }
+    SDL_GPUTextureCreateInfo tci = {0};
+    tci.type = SDL_GPU_TEXTURETYPE_2D;
+    tci.format = draw_format;
+    tci.usage = SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+    tci.width = WIDTH;
+    tci.height = HEIGHT;
+    tci.layer_count_or_depth = 1;
+    tci.num_levels = 1;
+    SDL_GPUTexture* texture = SDL_CreateGPUTexture(device, &tci);
+    if (!texture)
+    {
+        SDL_Log("Failed to create texture: %s", SDL_GetError());
+        return false;
+    }
+    SDL_GPUTransferBufferCreateInfo tbci = {0};
+    tbci.size = WIDTH * HEIGHT * 4;
+    tbci.usage = SDL_GPU_TRANSFERBUFFERUSAGE_DOWNLOAD;
+    SDL_GPUTransferBuffer* tbo = SDL_CreateGPUTransferBuffer(device, &tbci);
+    if (!tbo)
+    {
+        SDL_Log("Failed to create transfer buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTexture(device, texture);
+        return false;
+    }
+    SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+    if (!cb)
+    {
+        SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        SDL_ReleaseGPUTexture(device, texture);
+        return false;
+    }
+    if (!sim_draw(cb, sim, texture))
+    {
+        SDL_SubmitGPUCommandBuffer(cb);
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        SDL_ReleaseGPUTexture(device, texture);
+        return false;
+    }
+    SDL_GPUCopyPass* pass = SDL_BeginGPUCopyPass(cb);
+    if (!pass)
+    {
+        SDL_Log("Failed to begin copy pass: %s", SDL_GetError());
+        SDL_SubmitGPUCommandBuffer(cb);
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        SDL_ReleaseGPUTexture(device, texture);
+        return false;
+    }
+    SDL_GPUTextureRegion region = {0};
+    region.texture = texture;
+    region.w = WIDTH;
+    region.h = HEIGHT;
+    region.d = 1;
+    SDL_GPUTextureTransferInfo info = {0};
+    info.transfer_buffer = tbo;
+    SDL_DownloadFromGPUTexture(pass, &region, &info);
+    SDL_EndGPUCopyPass(pass);
+    SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+    SDL_ReleaseGPUTexture(device, texture);
+    if (!fence)
+    {
+        SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return false;
+    }
+    SDL_WaitForGPUFences(device, true, &fence, 1);
+    SDL_ReleaseGPUFence(device, fence);
+    uint8_t* data = SDL_MapGPUTransferBuffer(device, tbo, false);
+    if (!data)
+    {
+        SDL_Log("Failed to map transfer buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return false;
+    }
+    /* The draw blends over a transparent clear so make the image opaque */
+    for (uint32_t i = 0; i < WIDTH * HEIGHT; i++)
+    {
+        data[i * 4 + 3] = 0xFF;
+    }
+    SDL_Surface* surface = SDL_CreateSurfaceFrom(WIDTH, HEIGHT, pixel_format, data, WIDTH * 4);
+    bool saved = false;
+    if (!surface)
+    {
+        SDL_Log("Failed to create surface: %s", SDL_GetError());
+    }
+    else if (!(saved = SDL_SaveBMP(surface, path)))
+    {
+        SDL_Log("Failed to save image: %s, %s", path, SDL_GetError());
+    }
+    SDL_DestroySurface(surface);
+    SDL_UnmapGPUTransferBuffer(device, tbo);
+    SDL_ReleaseGPUTransferBuffer(device, tbo);
+    return saved;
+}
+
+static float half_to_float(
+    uint16_t half)
+{
+    const uint32_t sign = (half >> 15) & 0x1;
+    const uint32_t exponent = (half >> 10) & 0x1F;
+    const uint32_t mantissa = half & 0x3FF;
+    float value;
+    if (exponent == 0)
+    {
+        value = ldexpf(mantissa, -24);
+    }
+    else if (exponent == 31)
+    {
+        value = mantissa ? NAN : INFINITY;
+    }
+    else
+    {
+        value = ldexpf(mantissa | 0x400, exponent - 25);
+    }
+    return sign ? -value : value;
+}
+
+float* sim_read_trail(
+    sim_t* sim)
+{
+    assert(sim);
+    const uint32_t texels = WIDTH * HEIGHT * TRAIL_LAYERS;
+    SDL_GPUTransferBufferCreateInfo tbci = {0};
+    tbci.size = texels * formats[sim->format].size;
+    tbci.usage = SDL_GPU_TRANSFERBUFFERUSAGE_DOWNLOAD;
+    SDL_GPUTransferBuffer* tbo = SDL_CreateGPUTransferBuffer(device, &tbci);
+    if (!tbo)
+    {
+        SDL_Log("Failed to create transfer buffer: %s", SDL_GetError());
+        return NULL;
+    }
+    SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+    if (!cb)
+    {
+        SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return NULL;
+    }
+    SDL_GPUCopyPass* pass = SDL_BeginGPUCopyPass(cb);
+    if (!pass)
+    {
+        SDL_Log("Failed to begin copy pass: %s", SDL_GetError());
+        SDL_CancelGPUCommandBuffer(cb);
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return NULL;
+    }
+    for (int i = 0; i < TRAIL_LAYERS; i++)
+    {
+        SDL_GPUTextureRegion region = {0};
+        region.texture = sim->trail_texture1;
+        region.layer = i;
+        region.w = WIDTH;
+        region.h = HEIGHT;
+        region.d = 1;
+        SDL_GPUTextureTransferInfo info = {0};
+        info.transfer_buffer = tbo;
+        info.offset = i * WIDTH * HEIGHT * formats[sim->format].size;
+        SDL_DownloadFromGPUTexture(pass, &region, &info);
+    }
+    SDL_EndGPUCopyPass(pass);
+    SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+    if (!fence)
+    {
+        SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return NULL;
+    }
+    SDL_WaitForGPUFences(device, true, &fence, 1);
+    SDL_ReleaseGPUFence(device, fence);
+    const void* data = SDL_MapGPUTransferBuffer(device, tbo, false);
+    if (!data)
+    {
+        SDL_Log("Failed to map transfer buffer: %s", SDL_GetError());
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return NULL;
+    }
+    float* trail = malloc(texels * 4 * sizeof(float));
+    if (!trail)
+    {
+        SDL_Log("Failed to allocate trail");
+        SDL_UnmapGPUTransferBuffer(device, tbo);
+        SDL_ReleaseGPUTransferBuffer(device, tbo);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < texels * 4; i++)
+    {
+        switch (sim->format)
+        {
+        case TRAIL_FORMAT_F32:
+            trail[i] = ((const float*) data)[i];
+            break;
+        case TRAIL_FORMAT_F16:
+            trail[i] = half_to_float(((const uint16_t*) data)[i]);
+            break;
+        case TRAIL_FORMAT_UNORM8:
+            trail[i] = ((const uint8_t*) data)[i] / 255.0f;
+            break;
+        }
+    }
+    SDL_UnmapGPUTransferBuffer(device, tbo);
+    SDL_ReleaseGPUTransferBuffer(device, tbo);
+    return trail;
+}
+
+static double benchmark(
+    sim_t* sim,
+    int kernel)
+{
+    /* The first run warms up the pipeline and isn't measured */
+    double ms = 0.0;
+    for (int i = 0; i < 2; i++)
+    {
+        SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            return -1.0;
+        }
+        const int iterations = i ? TUNE_ITERATIONS : TUNE_WARMUP;
+        for (int j = 0; j < iterations; j++)
+        {
+            bool recorded;
+            switch (kernel)
+            {
+            case 0:
+                recorded = update(cb, sim, false, j, TIMESTEP);
+                break;
+            case 1:
+                recorded = update(cb, sim, true, j, TIMESTEP);
+                break;
+            default:
+                recorded = sim_blur(cb, sim);
+                break;
+            }
+            if (!recorded)
+            {
+                SDL_SubmitGPUCommandBuffer(cb);
+                return -1.0;
+            }
+        }
+        const uint64_t start = SDL_GetPerformanceCounter();
+        SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cb);
+        if (!fence)
+        {
+            SDL_Log("Failed to submit command buffer: %s", SDL_GetError());
+            return -1.0;
+        }
+        SDL_WaitForGPUFences(device, true, &fence, 1);
+        SDL_ReleaseGPUFence(device, fence);
+        const uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+        ms = elapsed * 1000.0 / SDL_GetPerformanceFrequency() / iterations;
+    }
+    return ms;
+}
+
+static bool tune(
+    sim_t* sim,
+    int kernel,
+    int* size,
+    int count)
+{
+    const int fallback = *size;
+    double best_ms = -1.0;
+    int best = fallback;
+    for (int i = 0; i < count; i++)
+    {
+        *size = i;
+        const double ms = benchmark(sim, kernel);
+        if (ms < 0.0)
+        {
+            *size = fallback;
+            return false;
+        }
+        if (best_ms < 0.0 || ms < best_ms)
+        {
+            best_ms = ms;
+            best = i;
+        }
+    }
+    *size = best;
+    return true;
+}
+
+static void get_tune_key(
+    char* key,
+    int size)
+{
+    const char* name = "unknown";
+#ifdef SDL_PROP_GPU_DEVICE_NAME_STRING
+    SDL_PropertiesID props = SDL_GetGPUDeviceProperties(device);
+    name = SDL_GetStringProperty(props, SDL_PROP_GPU_DEVICE_NAME_STRING, name);
+#endif
+    SDL_snprintf(key, size, "%s/%s/%dx%d/%d", SDL_GetGPUDeviceDriver(device), name,
+        WIDTH, HEIGHT, SPACING);
+}
+
+static bool load_tuning(
+    const char* path,
+    const char* key)
+{
+    char* data = SDL_LoadFile(path, NULL);
+    if (!data)
+    {
+        return false;
+    }
+    bool matched = false;
+    int sizes[2] = {-1, -1};
+    int blur_sizes_read[TRAIL_FORMAT_COUNT];
+    memcpy(blur_sizes_read, blur_size, sizeof(blur_size));
+    char* line = data;
+    while (line && *line)
+    {
+        char* end = strchr(line, '\n');
+        if (end)
+        {
+            *end = '\0';
+        }
+        char name[32];
+        int x;
+        int y;
+        if (!strncmp(line, "device ", 7))
+        {
+            matched = !strcmp(line + 7, key);
+        }
+        else if (sscanf(line, "%31s %dx%d", name, &x, &y) == 3)
+        {
+            for (int i = 0; i < TRAIL_FORMAT_COUNT; i++)
+            {
+                char blur[32];
+                SDL_snprintf(blur, sizeof(blur), "blur%s", formats[i].suffix);
+                if (strcmp(name, blur))
+                {
+                    continue;
+                }
+                for (int j = 0; j < BLUR_SIZE_COUNT; j++)
+                {
+                    if (blur_sizes[j].x == x && blur_sizes[j].y == y)
+                    {
+                        blur_sizes_read[i] = j;
+                    }
+                }
+            }
+        }
+        else if (sscanf(line, "%31s %d", name, &x) == 2)
+        {
+            for (int i = 0; i < UPDATE_SIZE_COUNT; i++)
+            {
+                if (update_sizes[i] == x && !strcmp(name, "update"))
+                {
+                    sizes[0] = i;
+                }
+                else if (update_sizes[i] == x && !strcmp(name, "update_direct"))
+                {
+                    sizes[1] = i;
+                }
+            }
+        }
+        line = end ? end + 1 : NULL;
+    }
+    SDL_free(data);
+    /* Tuning from another device or an older build is ignored */
+    if (!matched || sizes[0] < 0 || sizes[1] < 0)
+    {
+        return false;
+    }
+    update_size = sizes[0];
+    update_direct_size = sizes[1];
+    memcpy(blur_size, blur_sizes_read, sizeof(blur_size));
+    return true;
+}
+
+static void save_tuning(
+    const char* path,
+    const char* key,
+    const bool tuned[TRAIL_FORMAT_COUNT])
+{
+    char data[1024];
+    int size = SDL_snprintf(data, sizeof(data), "device %s\nupdate %d\nupdate_direct %d\n",
+        key, update_sizes[update_size], update_sizes[update_direct_size]);
+    for (int i = 0; i < TRAIL_FORMAT_COUNT; i++)
+    {
+        if (tuned[i])
+        {
+            const int j = blur_size[i];
+            size += SDL_snprintf(data + size, sizeof(data) - size, "blur%s %dx%d\n",
+                formats[i].suffix, blur_sizes[j].x, blur_sizes[j].y);
+        }
+    }
+    if (!SDL_SaveFile(path, data, size))
+    {
+        SDL_Log("Failed to save tuning: %s, %s", path, SDL_GetError());
+    }
+}
+
+bool sim_tune(
+    bool force)
+{
+    char* pref = SDL_GetPrefPath(NULL, "png2slime");
+    if (!pref)
+    {
+        SDL_Log("Failed to get pref path: %s", SDL_GetError());
+        return false;
+    }
+    char path[1024];
+    SDL_snprintf(path, sizeof(path), "%stune.txt", pref);
+    SDL_free(pref);
+    char key[256];
+    get_tune_key(key, sizeof(key));
+    if (!force && load_tuning(path, key))
+    {
+        SDL_Log("Loaded tuning: %s", path);
+        return true;
+    }
+    SDL_Log("Tuning workgroup sizes");
+    /* Random species give a full set of agents with every species mixed */
+    uint8_t* species = malloc(SITES);
+    if (!species)
+    {
+        SDL_Log("Failed to allocate species");
+        return false;
+    }
+    for (uint32_t i = 0; i < SITES; i++)
+    {
+        species[i] = rand() % COLOR_COUNT;
+    }
+    palette_t palette = {0};
+    palette.count = COLOR_COUNT;
+    bool tuned[TRAIL_FORMAT_COUNT] = {0};
+    bool success = true;
+    for (int i = 0; i < TRAIL_FORMAT_COUNT && success; i++)
+    {
+        const SDL_GPUTextureUsageFlags usage =
+            SDL_GPU_TEXTUREUSAGE_COMPUTE_STORAGE_WRITE |
+            SDL_GPU_TEXTUREUSAGE_SAMPLER |
+            SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+        if (!SDL_GPUTextureSupportsFormat(device, formats[i].format,
+            SDL_GPU_TEXTURETYPE_2D_ARRAY, usage))
+        {
+            continue;
+        }
+        sim_t sim;
+        if (!sim_create(&sim, i, species, &palette, 0, rand()))
+        {
+            SDL_Log("Failed to create simulation");
+            sim_destroy(&sim);
+            success = false;
+            break;
+        }
+        /* Run the simulation for a bit so sensing sees realistic trails */
+        SDL_GPUCommandBuffer* cb = SDL_AcquireGPUCommandBuffer(device);
+        if (!cb)
+        {
+            SDL_Log("Failed to acquire command buffer: %s", SDL_GetError());
+            sim_destroy(&sim);
+            success = false;
+            break;
+        }
+        for (int j = 0; j < TUNE_WARMUP && success; j++)
+        {
+            success = sim_sense(cb, &sim, false, j, TIMESTEP) && sim_blur(cb, &sim);
+        }
+        /* Leave a built summed-area table behind for the update kernel */
+        success = success && sat(cb, &sim);
+        SDL_SubmitGPUCommandBuffer(cb);
+        /* Sensing doesn't depend much on the trail format so it's only tuned once */
+        if (success && i == TRAIL_FORMAT_F32)
+        {
+            success =
+                tune(&sim, 0, &update_size, UPDATE_SIZE_COUNT) &&
+                tune(&sim, 1, &update_direct_size, UPDATE_SIZE_COUNT);
+            SDL_Log("Tuned update: %d, %d (direct)",
+                update_sizes[update_size], update_sizes[update_direct_size]);
+        }
+        success = success && tune(&sim, 2, &blur_size[i], BLUR_SIZE_COUNT);
+        if (success)
+        {
+            SDL_Log("Tuned blur (%s): %dx%d", formats[i].name,
+                blur_sizes[blur_size[i]].x, blur_sizes[blur_size[i]].y);
+        }
+        tuned[i] = success;
+        sim_destroy(&sim);
+    }
+    free(species);
+    if (!success)
+    {
+        SDL_Log("Failed to tune workgroup sizes");
+        return false;
+    }
+    save_tuning(path, key, tuned);
+    return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "palette.h"
+
+typedef enum
+{
+    TRAIL_FORMAT_F32,
+    TRAIL_FORMAT_F16,
+    TRAIL_FORMAT_UNORM8,
+    TRAIL_FORMAT_COUNT,
+}
+trail_format_t;
+
+typedef struct
+{
+    float x;
+    float y;
+    float angle;
+    uint32_t color;
+}
+agent_t;
+
+typedef struct
+{
+    trail_format_t format;
+    palette_t palette;
+    uint32_t agent_count;
+    SDL_GPUBuffer* agent_buffer;
+    SDL_GPUBuffer* sorted_buffer;
+    SDL_GPUBuffer* histogram_buffer;
+    SDL_GPUBuffer* offset_buffer;
+    SDL_GPUTexture* trail_texture1;
+    SDL_GPUTexture* trail_texture2;
+    SDL_GPUTexture* spare_texture;
+    bool published;
+    SDL_GPUTexture* sat_texture;
+    uint8_t* species;
+    SDL_GPUBuffer* site_buffer;
+    SDL_GPUBuffer* change_buffer;
+    uint32_t reseed_frame;
+}
+sim_t;
+
+typedef struct
+{
+    SDL_GPUTexture* trail_texture;
+    palette_t palette;
+}
+sim_snapshot_t;
+
+bool sim_init(
+    SDL_GPUDevice* device,
+    SDL_GPUTextureFormat format);
+void sim_quit();
+bool sim_tune(
+    bool force);
+bool sim_parse_format(
+    const char* name,
+    trail_format_t* format);
+const char* sim_get_format_name(
+    trail_format_t format);
+bool sim_create(
+    sim_t* sim,
+    trail_format_t format,
+    const uint8_t* species,
+    const palette_t* palette,
+    uint32_t agent_count,
+    uint32_t seed);
+void sim_destroy(
+    sim_t* sim);
+bool sim_sense(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    bool direct,
+    uint64_t time,
+    float dt);
+bool sim_reseed(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    const uint8_t* species);
+bool sim_sort(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim);
+bool sim_blur(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim);
+bool sim_draw(
+    SDL_GPUCommandBuffer* cb,
+    sim_t* sim,
+    SDL_GPUTexture* texture);
+bool sim_publish(
+    sim_t* sim,
+    sim_snapshot_t* snapshot);
+void sim_release_snapshot(
+    sim_snapshot_t* snapshot);
+bool sim_draw_snapshot(
+    SDL_GPUCommandBuffer* cb,
+    const sim_snapshot_t* snapshot,
+    SDL_GPUTexture* texture);
+bool sim_save(
+    sim_t* sim,
+    const char* path);
+float* sim_read_trail(
+    sim_t* sim);
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+#include <stb_image.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decode.h"
+
+/* Malformed headers have to be rejected by decoder_open instead of being decoded out of bounds */
+/* Baseline JPEGs have to match stb_image, give or take rounding and chroma upsampling */
+
+#define JPEG_TOLERANCE 8
+
+#define PNG_SIGNATURE 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+#define PNG_IHDR(width, height, depth, type) \
+    0, 0, 0, 13, 'I', 'H', 'D', 'R', \
+    (width) >> 24, ((width) >> 16) & 0xFF, ((width) >> 8) & 0xFF, (width) & 0xFF, \
+    (height) >> 24, ((height) >> 16) & 0xFF, ((height) >> 8) & 0xFF, (height) & 0xFF, \
+    depth, type, 0, 0, 0, 0, 0, 0, 0
+
+typedef struct
+{
+    const char* name;
+    const uint8_t* data;
+    size_t size;
+    bool valid;
+    uint8_t pixels[12];
+}
+test_t;
+
+/* 1x1 grayscale, a stored deflate block holding the filter byte and one sample */
+static const uint8_t png_gray8[] =
+{
+    PNG_SIGNATURE,
+    PNG_IHDR(1, 1, 8, 0),
+    0, 0, 0, 13, 'I', 'D', 'A', 'T', 0x78, 0x01, 0x01, 0x02, 0x00, 0xFD, 0xFF, 0x00, 0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* 4x1 grayscale, packed 2 bit samples 0 to 3 */
+static const uint8_t png_gray2[] =
+{
+    PNG_SIGNATURE,
+    PNG_IHDR(4, 1, 2, 0),
+    0, 0, 0, 13, 'I', 'D', 'A', 'T', 0x78, 0x01, 0x01, 0x02, 0x00, 0xFD, 0xFF, 0x00, 0x1B, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static const uint8_t png_depth0[] = {PNG_SIGNATURE, PNG_IHDR(1, 1, 0, 0)};
+static const uint8_t png_depth3[] = {PNG_SIGNATURE, PNG_IHDR(1, 1, 3, 0)};
+static const uint8_t png_depth7[] = {PNG_SIGNATURE, PNG_IHDR(1, 1, 7, 3)};
+static const uint8_t png_rgb4[] = {PNG_SIGNATURE, PNG_IHDR(1, 1, 4, 2)};
+static const uint8_t png_palette16[] = {PNG_SIGNATURE, PNG_IHDR(1, 1, 16, 3)};
+static const uint8_t png_wide[] = {PNG_SIGNATURE, PNG_IHDR(0x7FFFFFFF, 1, 16, 6)};
+static const uint8_t png_tall[] = {PNG_SIGNATURE, PNG_IHDR(1, 0x01000001, 8, 0)};
+static const uint8_t png_truncated[] = {PNG_SIGNATURE, 0, 0, 0, 13, 'I', 'H', 'D', 'R', 0, 0};
+
+/* Three codes of length 1 */
+static const uint8_t jpeg_oversubscribed[] =
+{
+    0xFF, 0xD8,
+    0xFF, 0xC4, 0x00, 0x16, 0x00,
+    3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 2,
+};
+
+/* 255 codes of length 2, which would index far past the fast table */
+static uint8_t jpeg_overflow[2 + 4 + 1 + 16 + 255];
+
+static const uint8_t jpeg_truncated[] = {0xFF, 0xD8, 0xFF, 0xC4, 0x00};
+
+/* 16x16 gradients, baseline with optimized Huffman tables */
+static const uint8_t jpeg_420[] =
+{
+    0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 0x4A, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x00, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x03, 0x02, 0x02, 0x03, 0x02, 0x02, 0x03,
+    0x03, 0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08, 0x05, 0x05, 0x04, 0x04, 0x05, 0x0A, 0x07,
+    0x07, 0x06, 0x08, 0x0C, 0x0A, 0x0C, 0x0C, 0x0B, 0x0A, 0x0B, 0x0B, 0x0D, 0x0E, 0x12, 0x10, 0x0D,
+    0x0E, 0x11, 0x0E, 0x0B, 0x0B, 0x10, 0x16, 0x10, 0x11, 0x13, 0x14, 0x15, 0x15, 0x15, 0x0C, 0x0F,
+    0x17, 0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14, 0xFF, 0xDB, 0x00, 0x43, 0x01, 0x03, 0x04,
+    0x04, 0x05, 0x04, 0x05, 0x09, 0x05, 0x05, 0x09, 0x14, 0x0D, 0x0B, 0x0D, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0xFF, 0xC0,
+    0x00, 0x11, 0x08, 0x00, 0x10, 0x00, 0x10, 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11,
+    0x01, 0xFF, 0xC4, 0x00, 0x15, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x07, 0xFF, 0xC4, 0x00, 0x1A, 0x10, 0x00, 0x02, 0x03,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x01,
+    0x04, 0x05, 0x31, 0x22, 0xFF, 0xC4, 0x00, 0x15, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x06, 0xFF, 0xC4, 0x00, 0x18, 0x11,
+    0x00, 0x02, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x04, 0x05, 0x21, 0x31, 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+    0x00, 0x3F, 0x00, 0x87, 0x56, 0xCC, 0x94, 0x85, 0x6B, 0x66, 0x71, 0x0C, 0xD6, 0xCC, 0x95, 0xE4,
+    0x52, 0xB6, 0x67, 0x11, 0x60, 0xFC, 0xAE, 0xD8, 0x78, 0xB7, 0xB2, 0xCF, 0xFF, 0xD9,
+};
+
+static const uint8_t jpeg_444[] =
+{
+    0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 0x4A, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x00, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x03, 0x02, 0x02, 0x03, 0x02, 0x02, 0x03,
+    0x03, 0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08, 0x05, 0x05, 0x04, 0x04, 0x05, 0x0A, 0x07,
+    0x07, 0x06, 0x08, 0x0C, 0x0A, 0x0C, 0x0C, 0x0B, 0x0A, 0x0B, 0x0B, 0x0D, 0x0E, 0x12, 0x10, 0x0D,
+    0x0E, 0x11, 0x0E, 0x0B, 0x0B, 0x10, 0x16, 0x10, 0x11, 0x13, 0x14, 0x15, 0x15, 0x15, 0x0C, 0x0F,
+    0x17, 0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14, 0xFF, 0xDB, 0x00, 0x43, 0x01, 0x03, 0x04,
+    0x04, 0x05, 0x04, 0x05, 0x09, 0x05, 0x05, 0x09, 0x14, 0x0D, 0x0B, 0x0D, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14,
+    0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0xFF, 0xC0,
+    0x00, 0x11, 0x08, 0x00, 0x10, 0x00, 0x10, 0x03, 0x01, 0x11, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11,
+    0x01, 0xFF, 0xC4, 0x00, 0x15, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x07, 0xFF, 0xC4, 0x00, 0x1A, 0x10, 0x00, 0x02, 0x03,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x01,
+    0x04, 0x05, 0x31, 0x22, 0xFF, 0xC4, 0x00, 0x16, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x04, 0x07, 0xFF, 0xC4, 0x00, 0x17,
+    0x11, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x04, 0x00, 0x03, 0x61, 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+    0x00, 0x3F, 0x00, 0x87, 0x56, 0xCC, 0x94, 0x8D, 0x6D, 0x0B, 0xA0, 0x2E, 0xF2, 0xB5, 0xB3, 0x38,
+    0x83, 0x68, 0x5F, 0x65, 0xC5, 0xDE, 0x66, 0xB6, 0x64, 0xAF, 0x24, 0x28, 0x5F, 0x6C, 0xC4, 0xBB,
+    0xCA, 0x56, 0xCC, 0xE2, 0x0D, 0xA1, 0x72, 0xE2, 0xEF, 0x7F, 0xFF, 0xD9,
+};
+
+static bool run(const test_t* test)
+{
+    const char* path = "decode_test.bin";
+    if (!SDL_SaveFile(path, test->data, test->size))
+    {
+        SDL_Log("Failed to save %s: %s", test->name, SDL_GetError());
+        return false;
+    }
+    int width;
+    int height;
+    decoder_t* decoder = decoder_open(path, &width, &height);
+    if (!test->valid)
+    {
+        decoder_close(decoder);
+        return !decoder;
+    }
+    if (!decoder)
+    {
+        return false;
+    }
+    uint8_t row[12];
+    const bool read = width <= 4 && height == 1 && decoder_read(decoder, row);
+    decoder_close(decoder);
+    return read && !memcmp(row, test->pixels, width * 3);
+}
+
+static bool compare(const test_t* test)
+{
+    const char* path = "decode_test.bin";
+    if (!SDL_SaveFile(path, test->data, test->size))
+    {
+        SDL_Log("Failed to save %s: %s", test->name, SDL_GetError());
+        return false;
+    }
+    int width;
+    int height;
+    int channels;
+    uint8_t* expected = stbi_load_from_memory(test->data, test->size, &width, &height, &channels, 3);
+    if (!expected)
+    {
+        SDL_Log("Failed to load %s: %s", test->name, stbi_failure_reason());
+        return false;
+    }
+    int decoded_width;
+    int decoded_height;
+    decoder_t* decoder = decoder_open(path, &decoded_width, &decoded_height);
+    uint8_t* row = malloc(width * 3);
+    bool passed = decoder && row && decoded_width == width && decoded_height == height;
+    int error = 0;
+    for (int y = 0; passed && y < height; y++)
+    {
+        passed = decoder_read(decoder, row);
+        for (int x = 0; passed && x < width * 3; x++)
+        {
+            error = SDL_max(error, abs(row[x] - expected[y * width * 3 + x]));
+        }
+    }
+    free(row);
+    decoder_close(decoder);
+    stbi_image_free(expected);
+    if (passed)
+    {
+        SDL_Log("%s: max error %d", test->name, error);
+    }
+    return passed && error <= JPEG_TOLERANCE;
+}
+
+int main(int argc, char** argv)
+{
+    jpeg_overflow[0] = 0xFF;
+    jpeg_overflow[1] = 0xD8;
+    jpeg_overflow[2] = 0xFF;
+    jpeg_overflow[3] = 0xC4;
+    jpeg_overflow[4] = (sizeof(jpeg_overflow) - 4) >> 8;
+    jpeg_overflow[5] = (sizeof(jpeg_overflow) - 4) & 0xFF;
+    jpeg_overflow[8] = 255;
+    const test_t tests[] =
+    {
+        {"png_gray8", png_gray8, sizeof(png_gray8), true, {128, 128, 128}},
+        {"png_gray2", png_gray2, sizeof(png_gray2), true, {0, 0, 0, 85, 85, 85, 170, 170, 170, 255, 255, 255}},
+        {"png_depth0", png_depth0, sizeof(png_depth0)},
+        {"png_depth3", png_depth3, sizeof(png_depth3)},
+        {"png_depth7", png_depth7, sizeof(png_depth7)},
+        {"png_rgb4", png_rgb4, sizeof(png_rgb4)},
+        {"png_palette16", png_palette16, sizeof(png_palette16)},
+        {"png_wide", png_wide, sizeof(png_wide)},
+        {"png_tall", png_tall, sizeof(png_tall)},
+        {"png_truncated", png_truncated, sizeof(png_truncated)},
+        {"jpeg_oversubscribed", jpeg_oversubscribed, sizeof(jpeg_oversubscribed)},
+        {"jpeg_overflow", jpeg_overflow, sizeof(jpeg_overflow)},
+        {"jpeg_truncated", jpeg_truncated, sizeof(jpeg_truncated)},
+    };
+    const test_t references[] =
+    {
+        {"jpeg_420", jpeg_420, sizeof(jpeg_420)},
+        {"jpeg_444", jpeg_444, sizeof(jpeg_444)},
+    };
+    int failures = 0;
+    for (int i = 0; i < SDL_arraysize(tests); i++)
+    {
+        const bool passed = run(&tests[i]);
+        SDL_Log("%s: %s", tests[i].name, passed ? "passed" : "failed");
+        failures += !passed;
+    }
+    for (int i = 0; i < SDL_arraysize(references); i++)
+    {
+        const bool passed = compare(&references[i]);
+        SDL_Log("%s: %s", references[i].name, passed ? "passed" : "failed");
+        failures += !passed;
+    }
+    SDL_RemovePath("decode_test.bin");
+    return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "config.h"
+#include "video.h"
+
+/* YUV4MPEG2 (.y4m) with 8 bit 4:2:0, 4:2:2, 4:4:4 or mono frames, from a file or stdin */
+struct video
+{
+    FILE* file;
+    int width;
+    int height;
+    int shift_x;
+    int shift_y;
+    int chroma_width;
+    int chroma_height;
+    bool mono;
+    bool full_range;
+    uint8_t* frame;
+    size_t frame_size;
+    uint32_t* starts;
+    uint32_t* sums;
+};
+
+static bool read_line(
+    FILE* file,
+    char* line,
+    int size)
+{
+    int length = 0;
+    int c;
+    while ((c = fgetc(file)) != EOF && c != '\n')
+    {
+        if (length + 1 < size)
+        {
+            line[length++] = c;
+        }
+    }
+    line[length] = '\0';
+    return c == '\n';
+}
+
+static bool parse_header(
+    video_t* video,
+    char* line)
+{
+    if (strncmp(line, "YUV4MPEG2 ", 10))
+    {
+        SDL_Log("Not a YUV4MPEG2 stream");
+        return false;
+    }
+    video->shift_x = 1;
+    video->shift_y = 1;
+    char* state = NULL;
+    for (char* token = SDL_strtok_r(line + 10, " ", &state); token; token = SDL_strtok_r(NULL, " ", &state))
+    {
+        switch (token[0])
+        {
+        case 'W':
+            video->width = atoi(token + 1);
+            break;
+        case 'H':
+            video->height = atoi(token + 1);
+            break;
+        case 'C':
+            if (!strcmp(token, "C420") || !strcmp(token, "C420jpeg") ||
+                !strcmp(token, "C420paldv") || !strcmp(token, "C420mpeg2"))
+            {
+                video->shift_x = 1;
+                video->shift_y = 1;
+            }
+            else if (!strcmp(token, "C422"))
+            {
+                video->shift_x = 1;
+                video->shift_y = 0;
+            }
+            else if (!strcmp(token, "C444"))
+            {
+                video->shift_x = 0;
+                video->shift_y = 0;
+            }
+            else if (!strcmp(token, "Cmono"))
+            {
+                video->mono = true;
+            }
+            else
+            {
+                SDL_Log("Unsupported colorspace: %s", token + 1);
+                return false;
+            }
+            break;
+        case 'X':
+            if (!strcmp(token, "XCOLORRANGE=FULL"))
+            {
+                video->full_range = true;
+            }
+            break;
+        }
+    }
+    if (video->width <= 0 || video->height <= 0)
+    {
+        SDL_Log("Invalid frame size: %dx%d", video->width, video->height);
+        return false;
+    }
+    video->chroma_width = (video->width + (1 << video->shift_x) - 1) >> video->shift_x;
+    video->chroma_height = (video->height + (1 << video->shift_y) - 1) >> video->shift_y;
+    video->frame_size = (size_t) video->width * video->height;
+    if (!video->mono)
+    {
+        video->frame_size += (size_t) video->chroma_width * video->chroma_height * 2;
+    }
+    return true;
+}
+
+video_t* video_open(
+    const char* path)
+{
+    video_t* video = calloc(1, sizeof(video_t));
+    if (!video)
+    {
+        SDL_Log("Failed to allocate video");
+        return NULL;
+    }
+    if (!strcmp(path, "-"))
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        video->file = stdin;
+    }
+    else
+    {
+        video->file = fopen(path, "rb");
+    }
+    if (!video->file)
+    {
+        SDL_Log("Failed to open video: %s", path);
+        free(video);
+        return NULL;
+    }
+    char line[1024];
+    if (!read_line(video->file, line, sizeof(line)) || !parse_header(video, line))
+    {
+        video_close(video);
+        return NULL;
+    }
+    video->frame = malloc(video->frame_size);
+    video->starts = malloc((COLUMNS + 1) * sizeof(uint32_t));
+    video->sums = malloc(COLUMNS * 3 * sizeof(uint32_t));
+    if (!video->frame || !video->starts || !video->sums)
+    {
+        SDL_Log("Failed to allocate frame");
+        video_close(video);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < COLUMNS; i++)
+    {
+        video->starts[i] = (uint64_t) i * SPACING * video->width / WIDTH;
+    }
+    video->starts[COLUMNS] = video->width;
+    SDL_Log("Opened video: %dx%d", video->width, video->height);
+    return video;
+}
+
+static uint8_t clamp(int value)
+{
+    return SDL_clamp(value, 0, 255);
+}
+
+bool video_read(
+    video_t* video,
+    uint8_t* colors)
+{
+    char line[256];
+    if (!read_line(video->file, line, sizeof(line)))
+    {
+        return false;
+    }
+    if (strncmp(line, "FRAME", 5))
+    {
+        SDL_Log("Invalid frame header");
+        return false;
+    }
+    if (fread(video->frame, 1, video->frame_size, video->file) != video->frame_size)
+    {
+        return false;
+    }
+    /* YUV is averaged per site and only the averages are converted, which is the same up to rounding */
+    const uint32_t w = video->width;
+    const uint32_t h = video->height;
+    const uint8_t* planes[3];
+    planes[0] = video->frame;
+    planes[1] = planes[0] + (size_t) w * h;
+    planes[2] = planes[1] + (size_t) video->chroma_width * video->chroma_height;
+    uint32_t* sums = video->sums;
+    const uint32_t* starts = video->starts;
+    for (uint32_t i = 0; i < ROWS; i++)
+    {
+        const uint32_t y1 = (uint64_t) i * SPACING * h / HEIGHT;
+        const uint32_t y2 = SDL_max(y1 + 1, (uint64_t) SDL_min((i + 1) * SPACING, HEIGHT) * h / HEIGHT);
+        memset(sums, 0, COLUMNS * 3 * sizeof(uint32_t));
+        for (uint32_t y = y1; y < y2; y++)
+        {
+            const uint8_t* luma = &planes[0][(size_t) y * w];
+            const size_t offset = (size_t) (y >> video->shift_y) * video->chroma_width;
+            for (uint32_t j = 0; j < COLUMNS; j++)
+            {
+                const uint32_t x2 = SDL_max(starts[j] + 1, starts[j + 1]);
+                for (uint32_t x = starts[j]; x < x2; x++)
+                {
+                    sums[j * 3 + 0] += luma[x];
+                }
+                if (video->mono)
+                {
+                    continue;
+                }
+                for (uint32_t x = starts[j]; x < x2; x++)
+                {
+                    sums[j * 3 + 1] += planes[1][offset + (x >> video->shift_x)];
+                    sums[j * 3 + 2] += planes[2][offset + (x >> video->shift_x)];
+                }
+            }
+        }
+        for (uint32_t j = 0; j < COLUMNS; j++)
+        {
+            const uint32_t count = (y2 - y1) * (SDL_max(starts[j] + 1, starts[j + 1]) - starts[j]);
+            int l = sums[j * 3 + 0] / count;
+            const int u = video->mono ? 0 : (int) (sums[j * 3 + 1] / count) - 128;
+            const int v = video->mono ? 0 : (int) (sums[j * 3 + 2] / count) - 128;
+            uint8_t* color = &colors[(i * COLUMNS + j) * 3];
+            if (video->full_range)
+            {
+                /* JFIF */
+                l *= 256;
+                color[0] = clamp((l + 359 * v + 128) >> 8);
+                color[1] = clamp((l - 88 * u - 183 * v + 128) >> 8);
+                color[2] = clamp((l + 454 * u + 128) >> 8);
+            }
+            else
+            {
+                /* BT.601 studio range */
+                l = (l - 16) * 298;
+                color[0] = clamp((l + 409 * v + 128) >> 8);
+                color[1] = clamp((l - 100 * u - 208 * v + 128) >> 8);
+                color[2] = clamp((l + 516 * u + 128) >> 8);
+            }
+        }
+    }
+    return true;
+}
+
+void video_close(
+    video_t* video)
+{
+    if (!video)
+    {
+        return;
+    }
+    if (video->file && video->file != stdin)
+    {
+        fclose(video->file);
+    }
+    free(video->frame);
+    free(video->starts);
+    free(video->sums);
+    free(video);
+}
\ No newline at end of file
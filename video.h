@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct video video_t;
+
+video_t* video_open(
+    const char* path);
+bool video_read(
+    video_t* video,
+    uint8_t* colors);
+void video_close(
+    video_t* video);
\ No newline at end of file